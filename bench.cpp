@@ -0,0 +1,181 @@
+#include "ui.h"
+#include "bot.h"
+#include "probe.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+enum {
+	BENCH_SEED = 1,
+	PERCENTILE_COUNT = 3,
+	BATCH_GAMES = 1024,
+	BATCH_KEY_ROUNDS = 64
+};
+
+const int PERCENTILES[PERCENTILE_COUNT] = { 50, 90, 99 };
+
+// Runs op in samples of ops_per_sample calls each, one sample to warm up,
+// and prints the result as one JSON line. setup runs before every sample
+// and is not measured.
+template<class Setup, class Op>
+void bench(const char * name, int samples, int ops_per_sample, Setup setup, Op op)
+{
+	setup();
+	for(int i = 0; i < ops_per_sample; ++i) {
+		op(i);
+	}
+	std::vector<double> sample_ns;
+	long allocations = 0;
+	double total_ns = 0;
+	for(int sample = 0; sample < samples; ++sample) {
+		setup();
+		long allocations_before = thread_allocations();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(int i = 0; i < ops_per_sample; ++i) {
+			op(sample * ops_per_sample + i);
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		allocations += thread_allocations() - allocations_before;
+		total_ns += elapsed.count();
+		sample_ns.push_back(elapsed.count() / ops_per_sample);
+	}
+	std::sort(sample_ns.begin(), sample_ns.end());
+	double ops = double(samples) * ops_per_sample;
+	printf("{\"name\": \"%s\", \"ops\": %.0f, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f",
+			name, ops, total_ns / ops, allocations / ops);
+	for(int i = 0; i < PERCENTILE_COUNT; ++i) {
+		int index = std::min(samples - 1, samples * PERCENTILES[i] / 100);
+		printf(", \"p%d_ns\": %.1f", PERCENTILES[i], sample_ns[index]);
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+void nothing()
+{
+}
+
+int main()
+{
+	int null_fd = open("/dev/null", O_WRONLY);
+	if(null_fd < 0) {
+		perror("/dev/null");
+		return 1;
+	}
+
+	bench("world_generation", 100, 10, nothing, [](int i) {
+		GameState state(BENCH_SEED + i);
+	});
+
+	{
+		AnsiTerminal term(null_fd, SCREEN_WIDTH, SCREEN_HEIGHT);
+		Game game(BENCH_SEED, term);
+		game.start();
+		game.handle_key(' ');
+		bench("travel_frame_full", 200, 10, nothing, [&](int) {
+			game.invalidate();
+			game.draw();
+			term.flush();
+		});
+		bench("draw_sprite", 200, 100, nothing, [&](int i) {
+			draw_sprite(term, Chthon::Point(0, 0), Chthon::Point(i % VIEW_SIZE, i / VIEW_SIZE % VIEW_SIZE), Tile(i % TILE_COUNT));
+		});
+	}
+
+	{
+		// Zoomed out map of a large world, a block of cells per character.
+		AnsiTerminal term(null_fd, SCREEN_WIDTH, SCREEN_HEIGHT);
+		Rules rules;
+		rules.world_size = 1024;
+		Game game(BENCH_SEED, term, FORECAST_TIME_MS, rules);
+		game.start();
+		for(char key : std::string(" m--")) {
+			game.handle_key(key);
+		}
+		bench("map_frame_zoomed", 200, 10, nothing, [&](int) {
+			game.invalidate();
+			game.draw();
+			term.flush();
+		});
+	}
+
+	// Battles at their first turn, with every enemy count, on the default
+	// battlefield and on sides without their own pathing.
+	const char moves[] = "hjklyubn";
+	for(int size : { int(BATTLEFIELD_SIZE), 6, 8 }) {
+		std::vector<Battle> battles;
+		for(int i = 0; i < 64; ++i) {
+			Random random(BENCH_SEED + i);
+			battles.push_back(Battle(size, 1 + i % BattleState::MAX_ENEMIES, PLAYER_BASE_HP, random.split()));
+		}
+		Battle battle;
+		std::string name = size == BATTLEFIELD_SIZE ? "battle_turn" : "battle_turn_" + std::to_string(size);
+		bench(name.c_str(), 200, 100, nothing, [&](int i) {
+			battle = battles[i % battles.size()];
+			battle.step(moves[i / battles.size() % 8], 0);
+		});
+	}
+
+	Random random(BENCH_SEED);
+	FreeCells full_map(MAP_SIZE, MAP_SIZE), free_cells(MAP_SIZE, MAP_SIZE);
+	bench("free_cell_take", 200, MAP_SIZE * MAP_SIZE / 2, [&]() { free_cells = full_map; }, [&](int) {
+		free_cells.take(random);
+	});
+
+	Bot bot;
+	bench("scripted_playthrough", 50, 1, nothing, [&](int i) {
+		GameState state(BENCH_SEED + i);
+		Bot player = bot;
+		while(!state.done()) {
+			state.step(player.act(state));
+		}
+	});
+
+	// Copy of a game well into a large world, as taken for undo.
+	Rules large_world;
+	large_world.world_size = 300;
+	GameState played(BENCH_SEED, large_world), snapshot(BENCH_SEED);
+	Bot walker = bot;
+	for(int i = 0; i < 200 && !played.done(); ++i) {
+		played.step(walker.act(played));
+	}
+	bench("game_snapshot", 200, 100, nothing, [&](int) {
+		snapshot = played;
+	});
+
+	// Field of view of the widest sight, stepping back and forth.
+	Fov wide_sight(MAX_SIGHT_RADIUS);
+	bench("sight_step", 200, 100, nothing, [&](int i) {
+		wide_sight.update(played.map, played.player + Chthon::Point(i % 2, 0));
+	});
+
+	// Many games stepped in lockstep, as a bot trainer does. One op is one
+	// random key for each game.
+	Rules rules;
+	std::vector<GameState> games;
+	for(int i = 0; i < BATCH_GAMES; ++i) {
+		games.push_back(GameState(BENCH_SEED + i, rules));
+	}
+	std::vector<std::vector<int>> batch_keys(BATCH_KEY_ROUNDS, std::vector<int>(BATCH_GAMES));
+	const char batch_moves[] = "hjklyubnyy";
+	for(std::vector<int> & keys : batch_keys) {
+		for(int & key : keys) {
+			key = batch_moves[random.range(sizeof(batch_moves) - 1)];
+		}
+	}
+	std::vector<GameState> stepped_games;
+	bench("lockstep_games", 20, 20, [&]() { stepped_games = games; }, [&](int i) {
+		const std::vector<int> & keys = batch_keys[i % BATCH_KEY_ROUNDS];
+		for(int game = 0; game < BATCH_GAMES; ++game) {
+			stepped_games[game].step(keys[game]);
+		}
+	});
+
+	close(null_fd);
+	return 0;
+}
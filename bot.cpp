@@ -0,0 +1,166 @@
+#include "bot.h"
+#include "solver.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+enum {
+	FORECAST_TIME_MS = 5,
+	// Paths are searched only this far, which covers the whole default world.
+	SIGHT_RADIUS = MAP_SIZE
+};
+
+const char DIRECTIONS[] = "hjklyubn";
+
+int count_pieces(const Chthon::Map<char> & puzzle)
+{
+	return std::count_if(puzzle.begin(), puzzle.end(), [](char piece) { return piece != 0; });
+}
+
+int distance(const Chthon::Point & a, const Chthon::Point & b)
+{
+	return std::max(std::abs(a.x - b.x), std::abs(a.y - b.y));
+}
+
+}
+
+Bot::Bot(int bot_pieces_to_dig, double bot_min_win_chance)
+	: pieces_to_dig(bot_pieces_to_dig), min_win_chance(bot_min_win_chance)
+{
+}
+
+int Bot::act(const GameState & state)
+{
+	switch(state.mode) {
+		case GameState::TRAVEL: return travel(state);
+		case GameState::ENCOUNTER: return encounter(state);
+		case GameState::BATTLE: return fight(state);
+		case GameState::MAP_MODE: return 'm';
+		case GameState::CHARACTER_MODE: return shop(state);
+		case GameState::MESSAGE: return ' ';
+	}
+	return 'q';
+}
+
+int Bot::max_fight(const GameState & state) const
+{
+	return 1 + (state.strength + state.endurance) / 4;
+}
+
+int Bot::encounter(const GameState & state)
+{
+	bool fight = state.encountered() <= max_fight(state);
+	if(min_win_chance > 0) {
+		// An inexact forecast is only an estimate, so then the group should
+		// also be small enough for the bot's own rule.
+		Forecast forecast = forecast_battle(state.battle, state.strength, FORECAST_TIME_MS);
+		fight = forecast.win >= min_win_chance && (forecast.exact || fight);
+	}
+	if(!fight) {
+		declined.push_back(state.destination);
+	}
+	return fight ? 'y' : 'n';
+}
+
+int Bot::travel(const GameState & state) const
+{
+	if(state.money >= std::min(state.strength_cost(), state.endurance_cost())) {
+		return 'c';
+	}
+	bool go_dig = count_pieces(state.puzzle) >= std::min(pieces_to_dig, state.rules.puzzle_size * state.rules.puzzle_size);
+	if(go_dig && state.player == state.artifact) {
+		return 'd';
+	}
+
+	int fight_limit = min_win_chance > 0 ? state.rules.max_enemy_count : max_fight(state);
+	auto group_size = [&](const Chthon::Point & pos) -> int {
+		int count = state.map.cell(pos).evil;
+		if(count > 0 && std::find(declined.begin(), declined.end(), pos) != declined.end()) {
+			return fight_limit + 1;
+		}
+		return count;
+	};
+	Chthon::Point corner(std::max(0, state.player.x - SIGHT_RADIUS), std::max(0, state.player.y - SIGHT_RADIUS));
+	Chthon::Map<int> first_step(
+			std::min(state.map.width(), state.player.x + SIGHT_RADIUS + 1) - corner.x,
+			std::min(state.map.height(), state.player.y + SIGHT_RADIUS + 1) - corner.y,
+			-1);
+	std::vector<Chthon::Point> queue;
+	queue.push_back(state.player);
+	first_step.cell(state.player - corner) = 0;
+	for(unsigned i = 0; i < queue.size(); ++i) {
+		Chthon::Point pos = queue[i];
+		int step = first_step.cell(pos - corner);
+		bool is_target = false;
+		if(go_dig) {
+			is_target = pos == state.artifact;
+		} else {
+			is_target = state.map.cell(pos).sprite == '*' || group_size(pos) > 0;
+		}
+		if(is_target && pos != state.player) {
+			return DIRECTIONS[step];
+		}
+		if(group_size(pos) > 0) {
+			continue;
+		}
+		for(int dir = 0; dir < 8; ++dir) {
+			Chthon::Point next = pos + get_shift(DIRECTIONS[dir]);
+			Chthon::Point local = next - corner;
+			if(!first_step.valid(local) || first_step.cell(local) >= 0) {
+				continue;
+			}
+			if(state.map.cell(next).sprite == '#' || group_size(next) > fight_limit) {
+				continue;
+			}
+			first_step.cell(local) = (pos == state.player) ? dir : step;
+			queue.push_back(next);
+		}
+	}
+	// With no target in sight, head for the artifact.
+	Chthon::Point closest = state.player;
+	for(const Chthon::Point & pos : queue) {
+		if(distance(pos, state.artifact) < distance(closest, state.artifact)) {
+			closest = pos;
+		}
+	}
+	if(closest != state.player) {
+		return DIRECTIONS[first_step.cell(closest - corner)];
+	}
+	return 'd';
+}
+
+int Bot::fight(const GameState & state) const
+{
+	const Battle & battle = state.battle;
+	Chthon::Point player = battle.pos(battle.player);
+	Board moves = battle.moves();
+	int best_control = 'q';
+	int best_distance = battle.size * 2;
+	for(int dir = 0; dir < 8; ++dir) {
+		Chthon::Point next = player + get_shift(DIRECTIONS[dir]);
+		if(!battle.valid(next)) {
+			continue;
+		}
+		if(!(moves & Battle::bit(battle.cell(next)))) {
+			continue;
+		}
+		for(int i = 0; i < battle.enemy_count; ++i) {
+			int dist = distance(next, battle.pos(battle.enemies[i]));
+			if(dist < best_distance) {
+				best_distance = dist;
+				best_control = DIRECTIONS[dir];
+			}
+		}
+	}
+	return best_control;
+}
+
+int Bot::shop(const GameState & state) const
+{
+	int cost = std::min(state.strength_cost(), state.endurance_cost());
+	if(state.money < cost) {
+		return ' ';
+	}
+	return state.strength_cost() <= state.endurance_cost() ? 'a' : 'b';
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "game.h"
+
+// Simple scripted player for simulations. It sees the whole map and knows
+// where the artifact is, but goes digging only after collecting enough
+// puzzle pieces, so its runs still depend on fights and treasure like a
+// human playthrough would.
+// With min_win_chance set it asks the battle solver before every fight
+// (an estimate from it has to agree with the group size rule as well)
+// and stays away from the groups it refused to fight.
+class Bot {
+public:
+	Bot(int pieces_to_dig = PUZZLE_SIZE * PUZZLE_SIZE / 3, double min_win_chance = 0);
+	int act(const GameState & state);
+private:
+	int pieces_to_dig;
+	double min_win_chance;
+	std::vector<Chthon::Point> declined;
+
+	int max_fight(const GameState & state) const;
+	int encounter(const GameState & state);
+	int travel(const GameState & state) const;
+	int fight(const GameState & state) const;
+	int shop(const GameState & state) const;
+};
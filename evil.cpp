@@ -0,0 +1,252 @@
+#include "evil.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const Chthon::Point DIRECTIONS[] = {
+	Chthon::Point(-1, 0), Chthon::Point(0, 1), Chthon::Point(0, -1), Chthon::Point(1, 0),
+	Chthon::Point(-1, -1), Chthon::Point(1, -1), Chthon::Point(-1, 1), Chthon::Point(1, 1),
+};
+
+int distance(const Chthon::Point & a, const Chthon::Point & b)
+{
+	return std::max(std::abs(a.x - b.x), std::abs(a.y - b.y));
+}
+
+int towards(int delta, int steps)
+{
+	return delta < 0 ? std::max(delta, -steps) : std::min(delta, steps);
+}
+
+}
+
+Evil::Evil(int evil_radius)
+	: radius(evil_radius), day(0), placed(false),
+	awake(std::make_shared<std::vector<Chthon::Point>>()), sleeping(std::make_shared<Sleepers>())
+{
+}
+
+void Evil::advance(World & map, const Chthon::Point & player, int today, int max_group)
+{
+	max_group = std::min<int>(max_group, MAX_EVIL_GROUP);
+	while(day < today) {
+		++day;
+		pass_day(map, player, max_group);
+	}
+}
+
+void Evil::pass_day(World & map, const Chthon::Point & player, int max_group)
+{
+	std::vector<Chthon::Point> & groups = unshare(awake);
+	// Groups that have walked today already: woken ones that made up for
+	// today too, and the ones others joined before their turn.
+	std::vector<Chthon::Point> moved;
+	while(!sleeping->heap.empty() && sleeping->heap.front().wake_day <= day) {
+		Sleepers & sleepers = unshare(sleeping);
+		std::pop_heap(sleepers.heap.begin(), sleepers.heap.end());
+		Sleeper sleeper = sleepers.heap.back();
+		sleepers.heap.pop_back();
+		if(!sleepers.live(sleeper)) {
+			continue;
+		}
+		sleepers.tickets.erase(Sleepers::key(sleeper.pos));
+		Chthon::Point pos = sleeper.pos;
+		int count = map.cell(pos).evil;
+		if(!count || std::find(groups.begin(), groups.end(), pos) != groups.end()) {
+			continue;
+		}
+		int steps = std::min(day - sleeper.since_day, distance(pos, player) - radius);
+		if(steps > 0) {
+			Chthon::Point target = pos + Chthon::Point(towards(player.x - pos.x, steps), towards(player.y - pos.y, steps));
+			if(free(map, target, player) && !map.cell(target).evil) {
+				map.set_evil(pos, 0);
+				map.set_evil(target, count);
+				pos = target;
+				if(steps == day - sleeper.since_day) {
+					moved.push_back(pos);
+				}
+			}
+		}
+		if(distance(pos, player) <= radius) {
+			groups.push_back(pos);
+		} else {
+			sleep(pos, player);
+		}
+	}
+
+	scan(map, player);
+
+	// Groups closest to the player go first and make way for the rest.
+	std::sort(groups.begin(), groups.end(), [&](const Chthon::Point & a, const Chthon::Point & b) {
+		int distance_a = distance(a, player), distance_b = distance(b, player);
+		if(distance_a != distance_b) {
+			return distance_a < distance_b;
+		}
+		return a.y != b.y ? a.y < b.y : a.x < b.x;
+	});
+	groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+	size_t still_awake = 0;
+	for(size_t i = 0; i < groups.size(); ++i) {
+		Chthon::Point pos = groups[i];
+		int count = map.cell(pos).evil;
+		if(!count) {
+			continue;
+		}
+		int best_distance = distance(pos, player);
+		Chthon::Point best = pos;
+		bool walked = std::find(moved.begin(), moved.end(), pos) != moved.end();
+		for(int dir = 0; dir < 8 && best_distance > 1 && !walked; ++dir) {
+			Chthon::Point next = pos + DIRECTIONS[dir];
+			int next_distance = distance(next, player);
+			if(next_distance < best_distance && free(map, next, player) && count + map.cell(next).evil <= max_group) {
+				best = next;
+				best_distance = next_distance;
+			}
+		}
+		if(best != pos) {
+			int there = map.cell(best).evil;
+			map.set_evil(pos, 0);
+			map.set_evil(best, count + there);
+			if(there) {
+				moved.push_back(best);
+				continue;
+			}
+			pos = best;
+		}
+		if(distance(pos, player) > radius) {
+			sleep(pos, player);
+		} else {
+			groups[still_awake++] = pos;
+		}
+	}
+	groups.resize(still_awake);
+}
+
+void Evil::scan(const World & map, const Chthon::Point & player)
+{
+	Chthon::Point new_origin = player - Chthon::Point(radius, radius);
+	Chthon::Point shift = new_origin - origin;
+	bool step = placed && std::abs(shift.x) <= 1 && std::abs(shift.y) <= 1;
+	if(step && shift.null()) {
+		return;
+	}
+	int side = radius * 2 + 1;
+	int new_row = shift.y > 0 ? side - 1 : 0;
+	int new_column = shift.x > 0 ? side - 1 : 0;
+	for(int y = 0; y < side; ++y) {
+		if(!step || (shift.y && y == new_row)) {
+			for(uint64_t row = map.evil_row(new_origin + Chthon::Point(0, y), side); row; row &= row - 1) {
+				wake(map, new_origin + Chthon::Point(__builtin_ctzll(row), y));
+			}
+		} else if(shift.x) {
+			wake(map, new_origin + Chthon::Point(new_column, y));
+		}
+	}
+	origin = new_origin;
+	placed = true;
+}
+
+void Evil::wake(const World & map, const Chthon::Point & pos)
+{
+	if(map.valid(pos) && map.cell(pos).evil && std::find(awake->begin(), awake->end(), pos) == awake->end()) {
+		unshare(awake).push_back(pos);
+		if(sleeping->tickets.count(Sleepers::key(pos))) {
+			unshare(sleeping).tickets.erase(Sleepers::key(pos));
+		}
+	}
+}
+
+void Evil::sleep(const Chthon::Point & pos, const Chthon::Point & player)
+{
+	// Both sides walking towards each other close two cells a day.
+	int wake_day = day + std::max(1, (distance(pos, player) - radius + 1) / 2);
+	Sleepers & sleepers = unshare(sleeping);
+	unsigned ticket = sleepers.next_ticket++;
+	sleepers.tickets[Sleepers::key(pos)] = ticket;
+	sleepers.heap.push_back(Sleeper(wake_day, day, pos, ticket));
+	std::push_heap(sleepers.heap.begin(), sleepers.heap.end());
+}
+
+bool Evil::free(const World & map, const Chthon::Point & pos, const Chthon::Point & player) const
+{
+	return map.valid(pos) && pos != player && map.cell(pos).sprite == '.';
+}
+
+std::vector<int32_t> Evil::pack() const
+{
+	std::vector<int32_t> data;
+	data.push_back(radius);
+	data.push_back(day);
+	data.push_back(placed);
+	data.push_back(origin.x);
+	data.push_back(origin.y);
+	data.push_back(awake->size());
+	for(const Chthon::Point & pos : *awake) {
+		data.push_back(pos.x);
+		data.push_back(pos.y);
+	}
+	data.push_back(sleeping->heap.size());
+	for(const Sleeper & sleeper : sleeping->heap) {
+		data.push_back(sleeper.wake_day);
+		data.push_back(sleeper.since_day);
+		data.push_back(sleeper.pos.x);
+		data.push_back(sleeper.pos.y);
+		data.push_back(sleeping->live(sleeper));
+	}
+	return data;
+}
+
+bool Evil::unpack(const std::vector<int32_t> & data, int world_size, int today)
+{
+	enum { HEAD_SIZE = 6 };
+	if(data.size() < HEAD_SIZE || data[0] < 1 || data[0] > MAX_EVIL_RADIUS || data[1] < 0 || data[1] > today) {
+		return false;
+	}
+	Evil result(data[0]);
+	result.day = data[1];
+	result.placed = data[2];
+	result.origin = Chthon::Point(data[3], data[4]);
+	size_t index = HEAD_SIZE;
+	if(data[5] < 0 || data.size() < index + size_t(data[5]) * 2 + 1) {
+		return false;
+	}
+	size_t awake_count = data[5];
+	for(size_t i = 0; i < awake_count; ++i, index += 2) {
+		result.awake->push_back(Chthon::Point(data[index], data[index + 1]));
+	}
+	if(data[index] < 0 || data.size() != index + 1 + size_t(data[index]) * 5) {
+		return false;
+	}
+	size_t sleeping_count = data[index++];
+	Sleepers & sleepers = *result.sleeping;
+	for(size_t i = 0; i < sleeping_count; ++i, index += 5) {
+		Chthon::Point pos(data[index + 2], data[index + 3]);
+		unsigned ticket = 0;
+		if(data[index + 4]) {
+			// One live entry a cell.
+			ticket = sleepers.next_ticket++;
+			if(!sleepers.tickets.insert(std::make_pair(Sleepers::key(pos), ticket)).second) {
+				return false;
+			}
+		}
+		sleepers.heap.push_back(Sleeper(data[index], data[index + 1], pos, ticket));
+	}
+	auto outside = [world_size](const Chthon::Point & pos) {
+		return pos.x < 0 || pos.x >= world_size || pos.y < 0 || pos.y >= world_size;
+	};
+	if(std::any_of(result.awake->begin(), result.awake->end(), outside)) {
+		return false;
+	}
+	for(const Sleeper & sleeper : sleepers.heap) {
+		if(outside(sleeper.pos) || sleeper.since_day > result.day) {
+			return false;
+		}
+	}
+	// Kept as saved: another heap of the same sleepers wakes them in another order.
+	if(!std::is_heap(sleepers.heap.begin(), sleepers.heap.end())) {
+		return false;
+	}
+	*this = result;
+	return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "world.h"
+#include <unordered_map>
+#include <vector>
+
+enum {
+	// Groups this close to the player move every day.
+	EVIL_RADIUS = 8,
+	// Rows of the area around the player are read as single words.
+	MAX_EVIL_RADIUS = 31
+};
+
+// Evil groups on the move. Groups stay where the world put them until the
+// player first comes within the radius; from then on they walk one step a
+// day towards the player, and two groups that meet join while they fit
+// into one battle. A group walks at most once a day, joined or not. A group left behind out of the radius falls asleep
+// until the earliest day it could be back in range, and then jumps
+// straight towards the player as far as it could have walked meanwhile.
+// So a day costs the groups around the player and the ones due to wake,
+// however many there are in the world.
+// Group sizes stay in the world cells, only positions are kept here.
+// Copies share the positions until one of them changes, so the sleepers
+// are only copied on the days some of them wake up or fall asleep.
+class Evil {
+public:
+	Evil(int evil_radius = EVIL_RADIUS);
+	// Brings the groups up to the day. max_group is the largest group
+	// that may form by joining.
+	void advance(World & map, const Chthon::Point & player, int today, int max_group);
+	// Positions, wake days and which heap entries are live as plain
+	// numbers, for saves and hashing.
+	std::vector<int32_t> pack() const;
+	// Returns false if the data is broken, does not fit into the world or
+	// is ahead of today.
+	bool unpack(const std::vector<int32_t> & data, int world_size, int today);
+private:
+	struct Sleeper {
+		int wake_day, since_day;
+		Chthon::Point pos;
+		unsigned ticket;
+		Sleeper(int sleeper_wake_day = 0, int sleeper_since_day = 0, const Chthon::Point & sleeper_pos = Chthon::Point(), unsigned sleeper_ticket = 0)
+			: wake_day(sleeper_wake_day), since_day(sleeper_since_day), pos(sleeper_pos), ticket(sleeper_ticket)
+		{}
+		// Earliest wake day on top of the heap.
+		bool operator<(const Sleeper & other) const { return wake_day > other.wake_day; }
+	};
+	// A group woken early or put to sleep again leaves its old entry in the
+	// heap. Only the entry with the ticket of its cell is live, the rest are
+	// dropped when they come up.
+	struct Sleepers {
+		// Heap by wake day.
+		std::vector<Sleeper> heap;
+		std::unordered_map<uint64_t, unsigned> tickets;
+		unsigned next_ticket;
+		Sleepers() : next_ticket(1) {}
+		static uint64_t key(const Chthon::Point & pos) { return uint64_t(uint32_t(pos.y)) << 32 | uint32_t(pos.x); }
+		bool live(const Sleeper & sleeper) const
+		{
+			std::unordered_map<uint64_t, unsigned>::const_iterator found = tickets.find(key(sleeper.pos));
+			return found != tickets.end() && found->second == sleeper.ticket;
+		}
+	};
+
+	int radius;
+	int day;
+	bool placed;
+	// Top left cell of the area around the player scanned last time.
+	Chthon::Point origin;
+	std::shared_ptr<std::vector<Chthon::Point>> awake;
+	std::shared_ptr<Sleepers> sleeping;
+
+	void pass_day(World & map, const Chthon::Point & player, int max_group);
+	void scan(const World & map, const Chthon::Point & player);
+	void wake(const World & map, const Chthon::Point & pos);
+	void sleep(const Chthon::Point & pos, const Chthon::Point & player);
+	bool free(const World & map, const Chthon::Point & pos, const Chthon::Point & player) const;
+};
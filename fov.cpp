@@ -0,0 +1,146 @@
+#include "fov.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+// Slopes of both edges of every cell of an octant, by distance and offset.
+struct Slopes {
+	double left[MAX_SIGHT_RADIUS + 1][MAX_SIGHT_RADIUS + 1];
+	double right[MAX_SIGHT_RADIUS + 1][MAX_SIGHT_RADIUS + 1];
+	Slopes()
+	{
+		for(int distance = 1; distance <= MAX_SIGHT_RADIUS; ++distance) {
+			for(int offset = 0; offset <= distance; ++offset) {
+				int dx = offset - distance, dy = -distance;
+				left[distance][offset] = (dx - 0.5) / (dy + 0.5);
+				right[distance][offset] = (dx + 0.5) / (dy - 0.5);
+			}
+		}
+	}
+};
+
+const Slopes SLOPES;
+
+}
+
+Fov::Fov(int fov_radius)
+	: range(fov_radius), placed(false), rows(std::make_shared<Rows>())
+{
+	rows->opaque.resize(side());
+	rows->visible.resize(side());
+}
+
+void Fov::load(const World & map, int x, int y, int count)
+{
+	uint64_t mask = (~uint64_t(0) >> (64 - count)) << x;
+	uint64_t blocks = map.forest_row(origin + Chthon::Point(x, y), count) << x;
+	rows->opaque[y] = (rows->opaque[y] & ~mask) | blocks;
+}
+
+void Fov::update(World & map, const Chthon::Point & center)
+{
+	Chthon::Point new_origin = center - Chthon::Point(range, range);
+	Chthon::Point shift = new_origin - origin;
+	uint64_t full_row = ~uint64_t(0) >> (64 - side());
+	Rows & window = unshare(rows);
+	bool step = placed && std::abs(shift.x) <= 1 && std::abs(shift.y) <= 1;
+	origin = new_origin;
+	if(step) {
+		// Rows move up or down a slot, bits move right or left, and what
+		// slid out of the window is replaced by the new edge.
+		for(std::vector<uint64_t> * plane : { &window.opaque, &window.visible }) {
+			if(shift.y > 0) {
+				std::rotate(plane->begin(), plane->begin() + 1, plane->end());
+			} else if(shift.y < 0) {
+				std::rotate(plane->begin(), plane->end() - 1, plane->end());
+			}
+			for(uint64_t & row : *plane) {
+				row = (shift.x > 0 ? row >> 1 : shift.x < 0 ? row << 1 : row) & full_row;
+			}
+		}
+		int new_row = shift.y > 0 ? side() - 1 : 0;
+		int new_column = shift.x > 0 ? side() - 1 : 0;
+		for(int y = 0; y < side(); ++y) {
+			if(shift.y && y == new_row) {
+				window.visible[y] = 0;
+				load(map, 0, y, side());
+			} else if(shift.x) {
+				window.visible[y] &= ~(uint64_t(1) << new_column);
+				load(map, new_column, y);
+			}
+		}
+	} else {
+		std::fill(window.visible.begin(), window.visible.end(), 0);
+		for(int y = 0; y < side(); ++y) {
+			load(map, 0, y, side());
+		}
+	}
+	placed = true;
+
+	uint64_t was_visible[MAX_SIGHT_RADIUS * 2 + 1];
+	std::copy(window.visible.begin(), window.visible.end(), was_visible);
+	std::fill(window.visible.begin(), window.visible.end(), 0);
+	window.visible[range] |= uint64_t(1) << range;
+	static const int OCTANTS[8][4] = {
+		{ 1, 0, 0, 1 }, { 0, 1, 1, 0 }, { 0, -1, 1, 0 }, { -1, 0, 0, 1 },
+		{ -1, 0, 0, -1 }, { 0, -1, -1, 0 }, { 0, 1, -1, 0 }, { 1, 0, 0, -1 },
+	};
+	for(const int * octant : OCTANTS) {
+		cast(1, 1.0, 0.0, octant[0], octant[1], octant[2], octant[3]);
+	}
+
+	for(int y = 0; y < side(); ++y) {
+		uint64_t fresh = window.visible[y] & ~was_visible[y];
+		while(fresh) {
+			int x = __builtin_ctzll(fresh);
+			fresh &= fresh - 1;
+			Chthon::Point pos = origin + Chthon::Point(x, y);
+			if(map.valid(pos)) {
+				map.see(pos);
+			}
+		}
+	}
+}
+
+// Recursive shadowcasting of one octant, rows going away from the center.
+// Slopes go from 1 (diagonal) to 0 (straight line); start and end bound
+// the part of the row not hidden yet.
+void Fov::cast(int row, double start, double end, int xx, int xy, int yx, int yy)
+{
+	if(start < end) {
+		return;
+	}
+	double new_start = start;
+	for(int distance = row; distance <= range; ++distance) {
+		bool blocked = false;
+		int dy = -distance;
+		for(int dx = -distance; dx <= 0; ++dx) {
+			double left_slope = SLOPES.left[distance][dx + distance];
+			double right_slope = SLOPES.right[distance][dx + distance];
+			if(start < right_slope) {
+				continue;
+			} else if(end > left_slope) {
+				break;
+			}
+			int x = range + dx * xx + dy * xy;
+			int y = range + dx * yx + dy * yy;
+			rows->visible[y] |= uint64_t(1) << x;
+			if(blocked) {
+				if(opaque(x, y)) {
+					new_start = right_slope;
+				} else {
+					blocked = false;
+					start = new_start;
+				}
+			} else if(opaque(x, y) && distance < range) {
+				blocked = true;
+				cast(distance + 1, start, left_slope, xx, xy, yx, yy);
+				new_start = right_slope;
+			}
+		}
+		if(blocked) {
+			return;
+		}
+	}
+}
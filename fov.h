@@ -0,0 +1,47 @@
+#pragma once
+#include "world.h"
+#include <vector>
+
+enum {
+	// Window rows are single words.
+	MAX_SIGHT_RADIUS = 31
+};
+
+// What the player sees: cells up to radius steps away in any direction
+// that are not hidden behind forest. Forest itself is seen.
+// Kept as bit rows of the window around the center, together with forest
+// rows of the same window. After a one step move both are shifted and only
+// the new edge of the window is read from the world, and only the cells
+// that came into sight are marked as seen there. Shadowcasting itself is
+// not incremental: a step moves the eye, which changes what every tree
+// hides, so it runs over the whole window again, but over the bit rows
+// rather than the world.
+// Copies share the rows until one of them moves.
+class Fov {
+public:
+	Fov(int fov_radius = 0);
+	int radius() const { return range; }
+	// Moves the field to center. Cells that came into sight are seen in the world.
+	void update(World & map, const Chthon::Point & center);
+	bool visible(const Chthon::Point & pos) const
+	{
+		Chthon::Point local = pos - origin;
+		return placed && local.x >= 0 && local.x < side() && local.y >= 0 && local.y < side()
+			&& (rows->visible[local.y] >> local.x & 1);
+	}
+private:
+	int range;
+	bool placed;
+	// Top left cell of the window.
+	Chthon::Point origin;
+	struct Rows {
+		std::vector<uint64_t> opaque, visible;
+	};
+	std::shared_ptr<Rows> rows;
+
+	int side() const { return range * 2 + 1; }
+	bool opaque(int x, int y) const { return rows->opaque[y] >> x & 1; }
+	// Forest of count cells of a row from x, a word at a time.
+	void load(const World & map, int x, int y, int count = 1);
+	void cast(int row, double start, double end, int xx, int xy, int yx, int yy);
+};
@@ -0,0 +1,219 @@
+#include "probe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Linked only into the binaries with a screen, so the allocation counter
+// does not replace operator new in wted-sim.
+
+namespace {
+
+enum {
+	FLUSH_INTERVAL_MS = 100
+};
+
+thread_local long allocation_count = 0;
+std::atomic<uint64_t> frame_count(0);
+
+}
+
+void * operator new(size_t size)
+{
+	++allocation_count;
+	void * p = malloc(size ? size : 1);
+	if(!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void * p) noexcept
+{
+	free(p);
+}
+
+void * operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void * p) noexcept
+{
+	free(p);
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	++allocation_count;
+	return malloc(size ? size : 1);
+}
+
+void * operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void * p, const std::nothrow_t &) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t &) noexcept
+{
+	free(p);
+}
+
+long thread_allocations()
+{
+	return allocation_count;
+}
+
+
+AsyncLog::AsyncLog(std::ostream & log_out)
+	: out(log_out), entries(CAPACITY), head(0), tail(0), dropped(0), reported_dropped(0), stopping(false),
+	flusher(&AsyncLog::flush_loop, this)
+{
+}
+
+AsyncLog::~AsyncLog()
+{
+	{
+		std::lock_guard<std::mutex> guard(wake_lock);
+		stopping = true;
+	}
+	wake.notify_one();
+	flusher.join();
+	drain();
+}
+
+void AsyncLog::text(const std::string & line)
+{
+	Entry * entry = reserve();
+	if(entry) {
+		entry->is_frame = false;
+		strncpy(entry->text, line.c_str(), TEXT_SIZE - 1);
+		entry->text[TEXT_SIZE - 1] = 0;
+		commit();
+	}
+}
+
+void AsyncLog::frame(const FrameRecord & record)
+{
+	Entry * entry = reserve();
+	if(entry) {
+		entry->is_frame = true;
+		entry->record = record;
+		commit();
+	}
+}
+
+AsyncLog::Entry * AsyncLog::reserve()
+{
+	unsigned position = head.load(std::memory_order_relaxed);
+	if(position - tail.load(std::memory_order_acquire) >= CAPACITY) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	return &entries[position % CAPACITY];
+}
+
+void AsyncLog::commit()
+{
+	head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void AsyncLog::flush_loop()
+{
+	std::unique_lock<std::mutex> lock(wake_lock);
+	while(!stopping) {
+		lock.unlock();
+		drain();
+		lock.lock();
+		wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+	}
+}
+
+void AsyncLog::drain()
+{
+	unsigned position = tail.load(std::memory_order_relaxed);
+	unsigned end = head.load(std::memory_order_acquire);
+	if(position == end) {
+		return;
+	}
+	for(; position != end; ++position) {
+		const Entry & entry = entries[position % CAPACITY];
+		if(!entry.is_frame) {
+			out << entry.text << '\n';
+			continue;
+		}
+		const FrameRecord & record = entry.record;
+		char line[256];
+		snprintf(line, sizeof(line), "frame %llu: rules_ns=%u draw_ns=%u output_ns=%u input_to_paint_ns=%u allocs=%ld",
+				(unsigned long long)record.frame, record.ns[PROBE_RULES], record.ns[PROBE_DRAW],
+				record.ns[PROBE_OUTPUT], record.ns[PROBE_INPUT_TO_PAINT], record.allocations);
+		out << line << '\n';
+	}
+	tail.store(position, std::memory_order_release);
+	unsigned long now_dropped = dropped.load(std::memory_order_relaxed);
+	if(now_dropped != reported_dropped) {
+		out << "log entries dropped: " << now_dropped - reported_dropped << '\n';
+		reported_dropped = now_dropped;
+	}
+	out.flush();
+}
+
+
+AsyncLogStream::AsyncLogStream(AsyncLog & target_log)
+	: std::ostream(nullptr), buffer(target_log)
+{
+	rdbuf(&buffer);
+}
+
+int AsyncLogStream::Buffer::overflow(int c)
+{
+	if(c == '\n') {
+		log.text(line);
+		line.clear();
+	} else if(c != EOF) {
+		line += char(c);
+	}
+	return c == EOF ? 0 : c;
+}
+
+
+FrameProbe::FrameProbe()
+	: enabled(probes_enabled.load(std::memory_order_relaxed)), start(0), last(0), allocations(0)
+{
+	if(enabled) {
+		start = last = probe_clock();
+		allocations = thread_allocations();
+		memset(&record, 0, sizeof(record));
+	}
+}
+
+void FrameProbe::lap(ProbeId probe)
+{
+	if(enabled) {
+		uint64_t now = probe_clock();
+		record_probe(probe, now - last);
+		record.ns[probe] = uint32_t(std::min<uint64_t>(now - last, UINT32_MAX));
+		last = now;
+	}
+}
+
+void FrameProbe::finish(AsyncLog * log)
+{
+	if(!enabled) {
+		return;
+	}
+	record_probe(PROBE_INPUT_TO_PAINT, last - start);
+	record.ns[PROBE_INPUT_TO_PAINT] = uint32_t(std::min<uint64_t>(last - start, UINT32_MAX));
+	record.frame = frame_count.fetch_add(1, std::memory_order_relaxed);
+	record.allocations = thread_allocations() - allocations;
+	if(log) {
+		log->frame(record);
+	}
+}
@@ -0,0 +1,492 @@
+#include "game.h"
+#include "probe.h"
+#include <chthon2/util.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+int fibonacci(int n)
+{
+	if(n <= 1) {
+		return 1;
+	}
+	return fibonacci(n - 1) + fibonacci(n - 2);
+}
+
+Chthon::Point get_shift(int control)
+{
+	switch(control) {
+		case 'h' : return Chthon::Point(-1,  0);
+		case 'j' : return Chthon::Point( 0,  1);
+		case 'k' : return Chthon::Point( 0, -1);
+		case 'l' : return Chthon::Point( 1,  0);
+		case 'y' : return Chthon::Point(-1, -1);
+		case 'u' : return Chthon::Point( 1, -1);
+		case 'b' : return Chthon::Point(-1,  1);
+		case 'n' : return Chthon::Point( 1,  1);
+		default: return Chthon::Point();
+	}
+}
+
+int Rules::max_battle_enemies() const
+{
+	return std::min<int>(BattleState::MAX_ENEMIES, (battle_size + 1) / 2);
+}
+
+void Rules::fit_enemy_count()
+{
+	max_enemy_count = std::min(max_enemy_count, max_battle_enemies());
+}
+
+std::string Rules::check() const
+{
+	if(battle_size < MIN_BATTLEFIELD_SIZE || battle_size > MAX_BATTLEFIELD_SIZE) {
+		return "Battlefield size should be between " + std::to_string(MIN_BATTLEFIELD_SIZE) + " and " + std::to_string(MAX_BATTLEFIELD_SIZE) + ".";
+	}
+	if(max_enemy_count < 1 || max_enemy_count > max_battle_enemies()) {
+		return "Max enemy count should be between 1 and " + std::to_string(max_battle_enemies()) + ".";
+	}
+	if(puzzle_size < 1 || puzzle_size > MAX_PUZZLE_SIZE || puzzle_size % 2 == 0) {
+		return "Puzzle size should be odd and between 1 and " + std::to_string(MAX_PUZZLE_SIZE) + ".";
+	}
+	if(world_size < puzzle_size || world_size > MAX_WORLD_SIZE) {
+		return "World size should be between " + std::to_string(puzzle_size) + " and " + std::to_string(MAX_WORLD_SIZE) + ".";
+	}
+	if(sight_radius < 1 || sight_radius > MAX_SIGHT_RADIUS) {
+		return "Sight radius should be between 1 and " + std::to_string(MAX_SIGHT_RADIUS) + ".";
+	}
+	return std::string();
+}
+
+namespace {
+
+static_assert(BattleState::MAX_CELL_COUNT <= 64, "Battlefield should fit into one bitboard.");
+
+// SIZE is the side of the battlefield when it is known at compile time,
+// otherwise 0 and the side is passed at runtime.
+template<int SIZE>
+struct BoardGeometry {
+	int size;
+	Board full, left_column, right_column;
+	BoardGeometry(int runtime_size)
+		: size(SIZE ? SIZE : runtime_size),
+		full(size * size == 64 ? ~Board(0) : (Board(1) << (size * size)) - 1),
+		// 1 + 2^size + 2^(2 * size) + ... is (2^(size^2) - 1) / (2^size - 1).
+		left_column(full / ((Board(1) << size) - 1)),
+		right_column(left_column << (size - 1))
+	{}
+	Board neighbours(Board board) const
+	{
+		Board row = (board | ((board << 1) & ~left_column) | ((board >> 1) & ~right_column)) & full;
+		return (row | (row << size) | (row >> size)) & full;
+	}
+};
+
+template<int SIZE>
+BoardGeometry<SIZE> geometry(int)
+{
+	return BoardGeometry<SIZE>(SIZE);
+}
+
+// Masks of other sides are computed once rather than on every call.
+template<>
+BoardGeometry<0> geometry<0>(int size)
+{
+	static const BoardGeometry<0> geometries[] = {
+		BoardGeometry<0>(3), BoardGeometry<0>(4), BoardGeometry<0>(5),
+		BoardGeometry<0>(6), BoardGeometry<0>(7), BoardGeometry<0>(8),
+	};
+	static_assert(sizeof(geometries) / sizeof(geometries[0]) == MAX_BATTLEFIELD_SIZE - MIN_BATTLEFIELD_SIZE + 1, "Every side should have its masks.");
+	return geometries[size - MIN_BATTLEFIELD_SIZE];
+}
+
+template<int SIZE>
+int move_enemies(BattleState & state)
+{
+	const BoardGeometry<SIZE> board = geometry<SIZE>(state.size);
+	Board passable = ~state.forest & board.full;
+	// Every cell in its own layer and one empty layer after them.
+	Board layers[(SIZE ? SIZE * SIZE : int(BattleState::MAX_CELL_COUNT)) + 1];
+	int depth = 0;
+	layers[0] = BattleState::bit(state.player);
+	Board reached = layers[0];
+	while(layers[depth] && (reached & state.occupied) != state.occupied) {
+		Board next = board.neighbours(layers[depth]) & passable & ~reached;
+		layers[++depth] = next;
+		reached |= next;
+	}
+
+	int attackers = 0;
+	for(int i = 0; i < state.enemy_count; ++i) {
+		Board enemy = BattleState::bit(state.enemies[i]);
+		int distance = 1;
+		while(distance <= depth && !(layers[distance] & enemy)) {
+			++distance;
+		}
+		if(distance > depth) {
+			continue;
+		}
+		Board steps = board.neighbours(enemy) & layers[distance - 1] & ~state.occupied;
+		if(!steps) {
+			continue;
+		}
+		int new_cell = __builtin_ctzll(steps);
+		if(new_cell == state.player) {
+			++attackers;
+		} else {
+			state.occupied ^= enemy | BattleState::bit(new_cell);
+			state.enemies[i] = new_cell;
+		}
+	}
+	return attackers;
+}
+
+}
+
+BattleState::BattleState(int battle_size)
+	: forest(0), occupied(0), size(battle_size), player(0), enemy_count(0), player_hp(0)
+{
+}
+
+Board BattleState::neighbours(Board board) const
+{
+	switch(size) {
+		case 3: return geometry<3>(size).neighbours(board);
+		case 5: return geometry<5>(size).neighbours(board);
+		case 7: return geometry<7>(size).neighbours(board);
+		default: return geometry<0>(size).neighbours(board);
+	}
+}
+
+int BattleState::enemy_at(int cell) const
+{
+	for(int i = 0; i < enemy_count; ++i) {
+		if(enemies[i] == cell) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool BattleState::hit_enemy(int index, int damage)
+{
+	enemy_hp[index] -= damage;
+	if(enemy_hp[index] > 0) {
+		return false;
+	}
+	occupied &= ~bit(enemies[index]);
+	--enemy_count;
+	for(int i = index; i < enemy_count; ++i) {
+		enemies[i] = enemies[i + 1];
+		enemy_hp[i] = enemy_hp[i + 1];
+	}
+	return true;
+}
+
+int BattleState::move_enemies()
+{
+	switch(size) {
+		case 3: return ::move_enemies<3>(*this);
+		case 5: return ::move_enemies<5>(*this);
+		case 7: return ::move_enemies<7>(*this);
+		default: return ::move_enemies<0>(*this);
+	}
+}
+
+int FightEvent::format(char * buffer, size_t size) const
+{
+	switch(type) {
+		case PLAYER_HIT: return snprintf(buffer, size, "You hit enemy for %d hp.", damage);
+		case ENEMY_DIED: return snprintf(buffer, size, "Enemy is dead.");
+		case ENEMY_HIT: return snprintf(buffer, size, "Enemy hit you for %d hp.", damage);
+		case PLAYER_DIED: return snprintf(buffer, size, "You are dead.");
+	}
+	return snprintf(buffer, size, "%s", "");
+}
+
+FightLog::FightLog(unsigned count, const std::vector<FightEvent> & kept)
+	: total(count - kept.size())
+{
+	for(const FightEvent & event : kept) {
+		push(event);
+	}
+}
+
+Battle::Battle()
+{
+}
+
+Battle::Battle(int battle_size, int battle_enemy_count, int battle_player_hp, const Random & battle_random)
+	: BattleState(battle_size), random(battle_random)
+{
+	player = cell(Chthon::Point(0, size / 2));
+	player_hp = battle_player_hp;
+	// Fewer trees than rows cannot wall the player off from the enemies.
+	int forest_count = random.range(std::min<int>(BATTLE_FOREST_COUNT, size));
+	for(int i = 0; i < forest_count; ++i) {
+		forest |= bit(cell(Chthon::Point(1, 0) + random_pos(random, size - 2, size)));
+	}
+	enemy_count = battle_enemy_count;
+	for(int i = 0; i < enemy_count; ++i) {
+		enemies[i] = cell(Chthon::Point(size - 1, (size / 2 + 1 - enemy_count) + i * 2));
+		enemy_hp[i] = ENEMY_BASE_HP;
+		occupied |= bit(enemies[i]);
+	}
+}
+
+Battle::Result Battle::step(int control, int strength)
+{
+	if(control == 'q') {
+		return LOST;
+	}
+	Chthon::Point shift = get_shift(control);
+	if(shift.null()) {
+		return ONGOING;
+	}
+	Chthon::Point target = pos(player) + shift;
+	if(!valid(target)) {
+		return ONGOING;
+	}
+	int target_cell = cell(target);
+	if(!(moves() & bit(target_cell))) {
+		return ONGOING;
+	}
+
+	int enemy = enemy_at(target_cell);
+	if(enemy >= 0) {
+		int damage = strength + random.range(PLAYER_DAMAGE_RANGE);
+		fightlog.push(FightEvent(FightEvent::PLAYER_HIT, damage));
+		if(hit_enemy(enemy, damage)) {
+			fightlog.push(FightEvent(FightEvent::ENEMY_DIED));
+		}
+	} else {
+		player = target_cell;
+	}
+
+	int attackers = 0;
+	{
+		Probe probe(PROBE_PATHING);
+		attackers = move_enemies();
+	}
+	for(int i = 0; i < attackers; ++i) {
+		int damage = random.range(ENEMY_DAMAGE_RANGE);
+		player_hp -= damage;
+		fightlog.push(FightEvent(FightEvent::ENEMY_HIT, damage));
+		if(player_hp <= 0) {
+			fightlog.push(FightEvent(FightEvent::PLAYER_DIED));
+			return LOST;
+		}
+	}
+	if(enemy_count == 0) {
+		return WON;
+	}
+	return ONGOING;
+}
+
+
+GameState::GameState(uint64_t game_seed, const Rules & game_rules)
+	: rules(game_rules), seed(game_seed), random(game_seed), fov(rules.sight_radius),
+	evil(std::max<int>(EVIL_RADIUS, rules.sight_radius)),
+	puzzle(rules.puzzle_size, rules.puzzle_size, 0), missing_pieces(rules.puzzle_size, rules.puzzle_size),
+	days_left(rules.days_left), money(0), strength(0), endurance(0),
+	mode(TRAVEL), message(NO_MESSAGE), outcome(PLAYING), finished(false)
+{
+	int size = rules.world_size;
+	player = random_pos(random, size, size);
+	int puzzle_radius = rules.puzzle_size / 2;
+	artifact = Chthon::Point(puzzle_radius, puzzle_radius)
+		+ random_pos(random, size - rules.puzzle_size + 1, size - rules.puzzle_size + 1);
+	map = World(random.next(), size, rules.max_enemy_count, player, artifact);
+	reveal();
+}
+
+int GameState::encountered() const
+{
+	if(mode != ENCOUNTER) {
+		return 0;
+	}
+	return map.cell(destination).evil;
+}
+
+void GameState::step(int control)
+{
+	if(finished) {
+		return;
+	}
+	switch(mode) {
+		case TRAVEL: travel(control); break;
+		case ENCOUNTER: encounter(control); break;
+		case BATTLE: fight(control); break;
+		case CHARACTER_MODE: shop(control); break;
+		case MAP_MODE:
+			if(control == 'm') {
+				mode = TRAVEL;
+			}
+			break;
+		case MESSAGE:
+			if(control == ' ') {
+				if(outcome != PLAYING) {
+					finished = true;
+				} else {
+					mode = TRAVEL;
+					message = NO_MESSAGE;
+				}
+			}
+			break;
+	}
+}
+
+void GameState::travel(int control)
+{
+	switch(control) {
+		case 'q' : finish(QUIT, NO_MESSAGE); return;
+		case 'm' : mode = MAP_MODE; return;
+		case 'c' : mode = CHARACTER_MODE; message = NO_MESSAGE; return;
+		case 'd':
+			if(player == artifact) {
+				finish(WON, ARTIFACT_FOUND);
+			} else {
+				days_left -= DAYS_FOR_DIGGING;
+				evil.advance(map, player, rules.days_left - days_left, rules.max_enemy_count);
+				if(days_left <= 0) {
+					finish(OUT_OF_TIME, TIME_RAN_OUT);
+				} else {
+					mode = MESSAGE;
+					message = NO_ARTIFACT_HERE;
+				}
+			}
+			return;
+	}
+	Chthon::Point shift = get_shift(control);
+	if(shift.null() || !map.valid(player + shift) || map.cell(player + shift).sprite == '#') {
+		return;
+	}
+	destination = player + shift;
+	mode = ENCOUNTER;
+	if(encountered()) {
+		battle = Battle(rules.battle_size, encountered(), PLAYER_BASE_HP + endurance, random.split());
+	} else {
+		mode = TRAVEL;
+		move_to(destination);
+		pass_day();
+	}
+}
+
+void GameState::encounter(int control)
+{
+	if(control == 'y') {
+		mode = BATTLE;
+	} else if(control == 'n') {
+		mode = TRAVEL;
+		pass_day();
+	}
+}
+
+void GameState::fight(int control)
+{
+	Battle::Result result = battle.step(control, strength);
+	if(result == Battle::LOST) {
+		finish(DIED, PLAYER_DIED);
+	} else if(result == Battle::WON) {
+		int enemy_count = map.cell(destination).evil;
+		map.clear(destination);
+		mode = TRAVEL;
+		move_to(destination);
+		money += rules.base_money_for_battle + random.range(MAX_MONEY_FOR_ONE_ENEMY) * enemy_count;
+
+		if(!missing_pieces.empty()) {
+			puzzle.cell(missing_pieces.take(random)) = 1;
+		}
+		pass_day();
+	}
+}
+
+void GameState::shop(int control)
+{
+	switch(control) {
+		case 'a':
+			if(money >= strength_cost()) {
+				money -= strength_cost();
+				++strength;
+			} else {
+				message = NOT_ENOUGH_FOR_STRENGTH;
+			}
+			break;
+		case 'b':
+			if(money >= endurance_cost()) {
+				money -= endurance_cost();
+				++endurance;
+			} else {
+				message = NOT_ENOUGH_FOR_ENDURANCE;
+			}
+			break;
+		case ' ': case 'c':
+			mode = TRAVEL;
+			message = NO_MESSAGE;
+			break;
+	}
+}
+
+void GameState::move_to(const Chthon::Point & new_pos)
+{
+	player = new_pos;
+	reveal();
+	if(map.cell(player).sprite == '*') {
+		money += TREASURE_MONEY;
+		map.clear(player);
+	}
+}
+
+void GameState::pass_day()
+{
+	--days_left;
+	evil.advance(map, player, rules.days_left - days_left, rules.max_enemy_count);
+	if(days_left <= 0) {
+		finish(OUT_OF_TIME, TIME_RAN_OUT);
+	}
+}
+
+void GameState::finish(Outcome game_outcome, Message final_message)
+{
+	outcome = game_outcome;
+	message = final_message;
+	if(message == NO_MESSAGE) {
+		finished = true;
+	} else {
+		mode = MESSAGE;
+	}
+}
+
+UndoHistory::UndoHistory(int history_levels)
+	: levels(history_levels)
+{
+}
+
+void UndoHistory::step(GameState & state, int control)
+{
+	if(state.mode != GameState::TRAVEL) {
+		state.step(control);
+		return;
+	}
+	if(control == UNDO_KEY) {
+		if(!snapshots.empty()) {
+			state = snapshots.back();
+			snapshots.pop_back();
+		}
+		return;
+	}
+	// Only moves and digging may take a turn.
+	if(get_shift(control).null() && control != 'd') {
+		state.step(control);
+		return;
+	}
+	GameState before = state;
+	state.step(control);
+	// Walking into forest, opening the map or the shop is not a turn.
+	if(state.days_left != before.days_left || state.mode == GameState::ENCOUNTER) {
+		snapshots.push_back(before);
+		if(int(snapshots.size()) > levels) {
+			snapshots.pop_front();
+		}
+	}
+}
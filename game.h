@@ -0,0 +1,239 @@
+#pragma once
+#include "random.h"
+#include "world.h"
+#include "fov.h"
+#include "evil.h"
+#include <chthon2/map.h>
+#include <deque>
+#include <vector>
+#include <string>
+
+enum {
+	BATTLEFIELD_SIZE = 5,
+	MIN_BATTLEFIELD_SIZE = 3,
+	// Battlefield cells fit into one bitboard word.
+	MAX_BATTLEFIELD_SIZE = 8,
+	BATTLE_FOREST_COUNT = 5,
+	MAP_SIZE = 25,
+	PUZZLE_SIZE = 5,
+	// Puzzle cells fit into the fixed arrays of a save.
+	MAX_PUZZLE_SIZE = 5,
+	VIEW_SIZE = 5,
+	VIEW_RADIUS = VIEW_SIZE / 2,
+
+	PLAYER_BASE_HP = 10,
+	ENEMY_BASE_HP = 10,
+	PLAYER_DAMAGE_RANGE = 3,
+	ENEMY_DAMAGE_RANGE = 3,
+	DAYS_LEFT = 300,
+	DAYS_FOR_DIGGING = 7,
+	MAX_ENEMY_COUNT = 3,
+	BASE_MONEY_FOR_BATTLE = 100,
+	MAX_MONEY_FOR_ONE_ENEMY = 200,
+	TREASURE_MONEY = 100,
+	STAT_COST = 100,
+	UNDO_KEY = 'z',
+	UNDO_LEVELS = 100,
+
+	COUNT
+};
+
+// Balance knobs that can be changed without recompiling.
+struct Rules {
+	int days_left;
+	int max_enemy_count;
+	int base_money_for_battle;
+	int stat_cost;
+	int world_size;
+	int sight_radius;
+	int battle_size;
+	// Odd, so the artifact is in the middle.
+	int puzzle_size;
+	Rules()
+		: days_left(DAYS_LEFT), max_enemy_count(MAX_ENEMY_COUNT),
+		base_money_for_battle(BASE_MONEY_FOR_BATTLE), stat_cost(STAT_COST),
+		world_size(MAP_SIZE), sight_radius(VIEW_RADIUS),
+		battle_size(BATTLEFIELD_SIZE), puzzle_size(PUZZLE_SIZE)
+	{}
+	// Largest group that still lines up on the right edge of the battlefield.
+	int max_battle_enemies() const;
+	// Smaller battlefields line up smaller groups.
+	void fit_enemy_count();
+	// Describes the first size that is out of range, empty if there is none.
+	std::string check() const;
+};
+
+int fibonacci(int n);
+Chthon::Point get_shift(int control);
+
+typedef uint64_t Board;
+
+// Whole battle in a few words: forests and enemies are bitboards with one
+// bit per battlefield cell, row by row, fighters are stored as cell indices.
+// The side is chosen at runtime; pathing is compiled separately for the
+// common sides, where shifts and edge masks become constants, and falls
+// back to a generic version for the rest.
+struct BattleState {
+	enum {
+		MAX_CELL_COUNT = MAX_BATTLEFIELD_SIZE * MAX_BATTLEFIELD_SIZE,
+		MAX_ENEMIES = MAX_EVIL_GROUP
+	};
+
+	Board forest, occupied;
+	int8_t size;
+	int8_t player, enemy_count;
+	int16_t player_hp;
+	int8_t enemies[MAX_ENEMIES];
+	int16_t enemy_hp[MAX_ENEMIES];
+
+	BattleState(int battle_size = BATTLEFIELD_SIZE);
+
+	bool valid(const Chthon::Point & pos) const { return pos.x >= 0 && pos.x < size && pos.y >= 0 && pos.y < size; }
+	int cell(const Chthon::Point & pos) const { return pos.y * size + pos.x; }
+	Chthon::Point pos(int cell) const { return Chthon::Point(cell % size, cell / size); }
+	static Board bit(int cell) { return Board(1) << cell; }
+	Board neighbours(Board board) const;
+
+	// Cells the player may step into, attacking enemies in them.
+	Board moves() const { return neighbours(bit(player)) & ~bit(player) & ~forest; }
+	int enemy_at(int cell) const;
+	// Returns true if the enemy was killed and removed.
+	bool hit_enemy(int index, int damage);
+	// Moves every enemy one step down the distance field from the player.
+	// Returns how many of them are adjacent and attack this turn.
+	int move_enemies();
+};
+
+struct FightEvent {
+	enum Type { NONE, PLAYER_HIT, ENEMY_DIED, ENEMY_HIT, PLAYER_DIED };
+	int8_t type;
+	int16_t damage;
+	FightEvent(int event_type = NONE, int event_damage = 0)
+		: type(event_type), damage(event_damage)
+	{}
+	bool operator==(const FightEvent & other) const { return type == other.type && damage == other.damage; }
+	bool operator!=(const FightEvent & other) const { return !(*this == other); }
+	// Writes the log line into buffer, returns its length like snprintf.
+	int format(char * buffer, size_t size) const;
+};
+
+// Last CAPACITY events of a battle, older ones are overwritten.
+// Events are kept as they are and turned into text only when shown.
+class FightLog {
+public:
+	enum { CAPACITY = 16 };
+	FightLog() : total(0) {}
+	// Log that had count events pushed in all, of which kept are the last
+	// ones, oldest first. There are min(count, CAPACITY) of them.
+	FightLog(unsigned count, const std::vector<FightEvent> & kept);
+	void push(const FightEvent & event) { events[total++ % CAPACITY] = event; }
+	// Events ever pushed, kept or not.
+	unsigned count() const { return total; }
+	unsigned size() const { return total < CAPACITY ? total : unsigned(CAPACITY); }
+	// Kept events, oldest first.
+	const FightEvent & operator[](unsigned index) const { return events[(total - size() + index) % CAPACITY]; }
+private:
+	FightEvent events[CAPACITY];
+	unsigned total;
+};
+
+struct Battle : public BattleState {
+	enum Result { ONGOING, WON, LOST };
+
+	FightLog fightlog;
+	Random random;
+
+	Battle();
+	Battle(int battle_size, int battle_enemy_count, int battle_player_hp, const Random & battle_random);
+	Result step(int control, int strength);
+};
+
+// Headless game rules. Everything is driven by step() with the same control
+// characters the terminal front end reads, so the state can be played by
+// a bot or a simulation without any screen attached.
+class GameState {
+public:
+	enum Mode {
+		TRAVEL,
+		ENCOUNTER,
+		BATTLE,
+		MAP_MODE,
+		CHARACTER_MODE,
+		MESSAGE
+	};
+	enum Message {
+		NO_MESSAGE,
+		ARTIFACT_FOUND,
+		NO_ARTIFACT_HERE,
+		PLAYER_DIED,
+		TIME_RAN_OUT,
+		NOT_ENOUGH_FOR_STRENGTH,
+		NOT_ENOUGH_FOR_ENDURANCE
+	};
+	enum Outcome {
+		PLAYING,
+		WON,
+		DIED,
+		OUT_OF_TIME,
+		QUIT
+	};
+
+	Rules rules;
+	uint64_t seed;
+	Random random;
+	World map;
+	Fov fov;
+	Evil evil;
+	Chthon::Point player, artifact;
+	Chthon::Map<char> puzzle;
+	FreeCells missing_pieces;
+	int days_left;
+	int money;
+	int strength, endurance;
+
+	Mode mode;
+	Message message;
+	Outcome outcome;
+	Chthon::Point destination;
+	// Set up as soon as an encounter starts, so it can be forecast
+	// before the player decides to fight.
+	Battle battle;
+
+	GameState(uint64_t game_seed, const Rules & game_rules = Rules());
+	void step(int control);
+	bool done() const { return finished; }
+	// Size of the evil group met, 0 outside of an encounter.
+	int encountered() const;
+	// Updates the field of view after the player has moved.
+	void reveal() { fov.update(map, player); }
+	int strength_cost() const { return fibonacci(strength + 1) * rules.stat_cost; }
+	int endurance_cost() const { return fibonacci(endurance + 1) * rules.stat_cost; }
+private:
+	bool finished;
+
+	void travel(int control);
+	void encounter(int control);
+	void fight(int control);
+	void shop(int control);
+	void move_to(const Chthon::Point & new_pos);
+	void pass_day();
+	void finish(Outcome game_outcome, Message final_message);
+};
+
+// Turns taken on the map, kept for undo: a move with the encounter or
+// battle that followed it, or digging. Each one is a snapshot of the whole
+// state, which is cheap to keep since copies share their world chunks,
+// changes, evil groups, missing pieces and field of view until written.
+class UndoHistory {
+public:
+	UndoHistory(int history_levels = UNDO_LEVELS);
+	// Applies control to the state. UNDO_KEY on the map brings back the
+	// state before the last turn instead.
+	void step(GameState & state, int control);
+	void clear() { snapshots.clear(); }
+	// Turns that can be undone now.
+	int size() const { return snapshots.size(); }
+private:
+	int levels;
+	std::deque<GameState> snapshots;
+};
@@ -0,0 +1,130 @@
+#include "journal.h"
+#include <algorithm>
+
+namespace {
+
+const char MAGIC[] = { 'W', 'T', 'E', 'D' };
+const char VERSION = 4;
+
+struct Hash {
+	uint64_t value;
+	Hash() : value(0xcbf29ce484222325ULL) {}
+	void add(uint64_t data)
+	{
+		for(int i = 0; i < 8; ++i) {
+			value = (value ^ ((data >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+		}
+	}
+};
+
+}
+
+JournalWriter::JournalWriter(const std::string & filename, uint64_t seed, const Rules & rules)
+	: out(filename.c_str(), std::ios::binary | std::ios::trunc)
+{
+	out.write(MAGIC, sizeof(MAGIC));
+	out.put(VERSION);
+	for(int i = 0; i < 8; ++i) {
+		out.put(char(seed >> (i * 8)));
+	}
+	for(int i = 0; i < 4; ++i) {
+		out.put(char(rules.world_size >> (i * 8)));
+	}
+	out.put(char(rules.sight_radius));
+	out.put(char(rules.battle_size));
+	out.put(char(rules.puzzle_size));
+	out.put(char(rules.max_enemy_count));
+	out.flush();
+}
+
+void JournalWriter::record(int key)
+{
+	if(key < 0) {
+		return;
+	}
+	unsigned value = key;
+	while(value >= 0x80) {
+		out.put(char(value | 0x80));
+		value >>= 7;
+	}
+	out.put(char(value));
+}
+
+JournalReader::JournalReader(const std::string & filename)
+	: in(filename.c_str(), std::ios::binary), valid(false), game_seed(0)
+{
+	char header[sizeof(MAGIC) + 1 + 8 + 4 + 1 + 1 + 1 + 1];
+	if(!in.read(header, sizeof(header))) {
+		return;
+	}
+	if(!std::equal(MAGIC, MAGIC + sizeof(MAGIC), header) || header[sizeof(MAGIC)] != VERSION) {
+		return;
+	}
+	for(int i = 0; i < 8; ++i) {
+		game_seed |= uint64_t((unsigned char)header[sizeof(MAGIC) + 1 + i]) << (i * 8);
+	}
+	game_rules.world_size = 0;
+	for(int i = 0; i < 4; ++i) {
+		game_rules.world_size |= int((unsigned char)header[sizeof(MAGIC) + 1 + 8 + i]) << (i * 8);
+	}
+	game_rules.sight_radius = header[sizeof(MAGIC) + 1 + 8 + 4];
+	game_rules.battle_size = header[sizeof(MAGIC) + 1 + 8 + 4 + 1];
+	game_rules.puzzle_size = header[sizeof(MAGIC) + 1 + 8 + 4 + 2];
+	game_rules.max_enemy_count = header[sizeof(MAGIC) + 1 + 8 + 4 + 3];
+	valid = game_rules.check().empty();
+}
+
+bool JournalReader::next(int & key)
+{
+	if(!valid) {
+		return false;
+	}
+	unsigned value = 0;
+	for(int shift = 0; shift < 32; shift += 7) {
+		int byte = in.get();
+		if(byte == EOF) {
+			return false;
+		}
+		value |= unsigned(byte & 0x7f) << shift;
+		if(!(byte & 0x80)) {
+			key = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint64_t fingerprint(const GameState & state)
+{
+	Hash hash;
+	hash.add(state.outcome);
+	hash.add(state.mode);
+	hash.add(state.days_left);
+	hash.add(state.money);
+	hash.add(state.strength);
+	hash.add(state.endurance);
+	hash.add(state.player.x);
+	hash.add(state.player.y);
+	// Unexplored chunks are the same as generated, the seed covers them.
+	for(const Chthon::Point & origin : state.map.explored_chunks()) {
+		for(int y = 0; y < CHUNK_SIZE; ++y) {
+			for(int x = 0; x < CHUNK_SIZE; ++x) {
+				Chthon::Point pos = origin + Chthon::Point(x, y);
+				if(state.map.valid(pos)) {
+					Cell cell = state.map.cell(pos);
+					hash.add(cell.sprite | cell.seen << 8 | cell.evil << 16);
+				}
+			}
+		}
+	}
+	for(char piece : state.puzzle) {
+		hash.add(piece);
+	}
+	hash.add(state.battle.player_hp);
+	for(int32_t value : state.evil.pack()) {
+		hash.add(value);
+	}
+	Random random = state.random;
+	hash.add(random.next());
+	return hash.value;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "game.h"
+#include <fstream>
+#include <string>
+
+// Binary record of one game: a header with the seed, the sizes of the
+// world, sight, battlefield and puzzle and the largest enemy group, then
+// every key passed to GameState::step() as a LEB128 varint, so plain keys
+// take one byte each. The header and the keys are enough to replay
+// the game exactly.
+class JournalWriter {
+public:
+	JournalWriter(const std::string & filename, uint64_t seed, const Rules & rules = Rules());
+	bool is_open() const { return out.is_open(); }
+	// Keys are buffered until flush(), which the game calls once a frame,
+	// so a crash loses at most the keys of the frame it happened in.
+	void record(int key);
+	void flush() { out.flush(); }
+private:
+	std::ofstream out;
+};
+
+class JournalReader {
+public:
+	JournalReader(const std::string & filename);
+	// False if the file is missing or is not a journal.
+	bool is_valid() const { return valid; }
+	uint64_t seed() const { return game_seed; }
+	// Default rules with the recorded sizes.
+	const Rules & rules() const { return game_rules; }
+	bool next(int & key);
+private:
+	std::ifstream in;
+	bool valid;
+	uint64_t game_seed;
+	Rules game_rules;
+};
+
+// Hash of the game state, for checking that replays end up the same.
+uint64_t fingerprint(const GameState & state);
@@ -1,639 +1,171 @@
-#include <chthon2/pathfinding.h>
-#include <chthon2/map.h>
+#include "ui.h"
+#include "server.h"
+#include "journal.h"
+#include "probe.h"
 #include <chthon2/log.h>
-#include <chthon2/format.h>
-#include <chthon2/util.h>
-#include <ncurses.h>
 #include <fstream>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <ctime>
 
-enum {
-	BATTLEFIELD_SIZE = 5,
-	BATTLE_FOREST_COUNT = 5,
-	MAP_SIZE = 25,
-	PUZZLE_SIZE = 5,
-	PUZZLE_RADIUS = PUZZLE_SIZE / 2,
-	VIEW_SIZE = 5,
-	VIEW_RADIUS = VIEW_SIZE / 2,
-	LEFT_STATUS_BAR = VIEW_SIZE * 9,
-	FIGHTLOG_SIZE = 10,
+const char * OUTCOME_NAMES[] = { "playing", "won", "died", "out_of_time", "quit" };
 
-	PLAYER_BASE_HP = 10,
-	ENEMY_BASE_HP = 10,
-	PLAYER_DAMAGE_RANGE = 3,
-	ENEMY_DAMAGE_RANGE = 3,
-	DAYS_LEFT = 300,
-	DAYS_FOR_DIGGING = 7,
-	MAX_ENEMY_COUNT = 3,
-	BASE_MONEY_FOR_BATTLE = 100,
-	MAX_MONEY_FOR_ONE_ENEMY = 200,
-	TREASURE_MONEY = 100,
-
-	COUNT
-};
-
-const Chthon::Point BATTLE_MAP(0, 0);
-const Chthon::Point VIEW_MAP(0, 0);
-const Chthon::Point PUZZLE_CENTER(LEFT_STATUS_BAR + 6, 4);
-
-struct Character {
-	Chthon::Point pos;
-	int hp;
-	Character(const Chthon::Point & char_pos, int char_hp)
-		: pos(char_pos), hp(char_hp)
-	{}
-};
-
-struct Evil {
-	Chthon::Point pos;
-	int count;
-	Evil(const Chthon::Point & evil_pos = Chthon::Point(), int evil_count = 1)
-		: pos(evil_pos), count(evil_count)
-	{}
-};
-
-struct Cell {
-	char sprite;
-	bool seen;
-	Cell(char cell_sprite = ' ', bool cell_seen = false)
-		: sprite(cell_sprite), seen(cell_seen)
-	{}
-};
-
-typedef int MiniSprite;
-typedef Chthon::Map<int> Sprite;
-
-template<class T, class Generator, class Check>
-T generate_value(int tries, Generator generator, Check check)
-{
-	T value = generator();
-	while(!check(value) && tries --> 0) {
-		value = generator();
-	}
-	return value;
-}
-
-Chthon::Point get_random_free_pos(const Chthon::Map<Cell> & map)
+void toggle_probes(int)
 {
-	return generate_value<Chthon::Point>(MAP_SIZE * MAP_SIZE,
-			[](){ return Chthon::Point(rand() % MAP_SIZE, rand() % MAP_SIZE); },
-			[map](const Chthon::Point & p){ return map.cell(p).sprite == '.'; }
-			);
+	probes_enabled.store(!probes_enabled.load(std::memory_order_relaxed), std::memory_order_relaxed);
 }
 
-Chthon::Point get_random_free_pos(const Chthon::Map<Cell> & map, const std::list<Evil> & evil)
+Terminal * create_terminal(bool ansi)
 {
-	return generate_value<Chthon::Point>(MAP_SIZE * MAP_SIZE,
-			[](){ return Chthon::Point(rand() % MAP_SIZE, rand() % MAP_SIZE); },
-			[map, evil](const Chthon::Point & p){
-				for(const Evil & e : evil) {
-					if(e.pos == p) {
-						return false;
-					}
-				}
-				return map.cell(p).sprite == '.';
-			}
-			);
-}
-
-void draw_sprite(const Chthon::Point & start, const Chthon::Point & pos, const Sprite & sprite)
-{
-	for(int x = 0; x < sprite.width(); ++x) {
-		for(int y = 0; y < sprite.height(); ++y) {
-			mvaddch(
-					start.y + pos.y * sprite.height() + y,
-					start.x + pos.x * sprite.width() + x,
-					sprite.cell(x, y));
-		}
+	if(ansi) {
+		return new AnsiTerminal();
 	}
+	return new CursesTerminal();
 }
 
-int fibonacci(int n)
+// Without a delay the journal is replayed headless as fast as possible
+// and the result is printed, otherwise every key is shown.
+int replay(const std::string & filename, int delay_ms, bool ansi)
 {
-	if(n <= 1) {
+	JournalReader journal(filename);
+	if(!journal.is_valid()) {
+		fprintf(stderr, "%s: not a wted journal\n", filename.c_str());
 		return 1;
 	}
-	return fibonacci(n - 1) + fibonacci(n - 2);
-}
-
-Chthon::Point get_shift(int control)
-{
-	switch(control) {
-		case 'h' : return Chthon::Point(-1,  0);
-		case 'j' : return Chthon::Point( 0,  1);
-		case 'k' : return Chthon::Point( 0, -1);
-		case 'l' : return Chthon::Point( 1,  0);
-		case 'y' : return Chthon::Point(-1, -1);
-		case 'u' : return Chthon::Point( 1, -1);
-		case 'b' : return Chthon::Point(-1,  1);
-		case 'n' : return Chthon::Point( 1,  1);
-		default: return Chthon::Point();
-	}
-}
-
-void artifact_found()
-{
-	mvprintw(11, 27, "+--------------------------+");
-	mvprintw(12, 27, "|You've found the artifact!|");
-	mvprintw(13, 27, "|      Good for you.       |");
-	mvprintw(14, 27, "| (press <space> to exit)  |");
-	mvprintw(15, 27, "+--------------------------+");
-	while(getch() != ' ');
-}
-
-void no_artifact_here()
-{
-	mvprintw(11, 27, "+--------------------------+");
-	mvprintw(12, 27, "|  Artifact is not here!   |");
-	mvprintw(13, 27, "| Precious time is wasted. |");
-	mvprintw(14, 27, "|      (press <space>)     |");
-	mvprintw(15, 27, "+--------------------------+");
-	while(getch() != ' ');
-}
-
-void player_died()
-{
-	mvprintw(11, 27, "+--------------------------+");
-	mvprintw(12, 27, "|You were killed in battle.|");
-	mvprintw(13, 27, "|      Game is over.       |");
-	mvprintw(14, 27, "| (press <space> to exit)  |");
-	mvprintw(15, 27, "+--------------------------+");
-	while(getch() != ' ');
-}
-
-void time_ran_out()
-{
-	mvprintw(11, 27, "+---------------------------+");
-	mvprintw(12, 27, "|Time ran out and you didn't|");
-	mvprintw(13, 27, "|     find the artifact.    |");
-	mvprintw(14, 27, "|  (press <space> to exit)  |");
-	mvprintw(15, 27, "+---------------------------+");
-	while(getch() != ' ');
-}
-
-class Game {
-public:
-	Game();
-	virtual ~Game();
-	void create();
-	int run();
-private:
-	Chthon::Map<Cell> map;
-	Chthon::Point player, artifact;
-	Chthon::Map<char> puzzle;
-	std::list<Evil> evil;
-	int days_left;
-	int money;
-	bool quit;
-	int strength, endurance;
-	std::map<char, MiniSprite> minisprites;
-	std::map<char, Sprite> sprites;
-	Sprite statusbar, fight_statusbar;
-
-	bool fight(int enemy_count);
-	void map_mode();
-	void character_mode();
-};
-
-bool Game::fight(int enemy_count)
-{
-	bool done = false;
-	Chthon::Map<char> battlefield(BATTLEFIELD_SIZE, BATTLEFIELD_SIZE, '.');
-	int forest_count = rand() % BATTLE_FOREST_COUNT;
-	for(int i = 0; i < forest_count; ++i) {
-		battlefield.cell(1 + rand() % (BATTLEFIELD_SIZE - 2), rand() % BATTLEFIELD_SIZE) = '#';
-	}
-	Character player({0, BATTLEFIELD_SIZE / 2}, PLAYER_BASE_HP + endurance);
-	std::vector<Character> enemies;
-	for(int i = 0; i < enemy_count; ++i) {
-		enemies << Character({BATTLEFIELD_SIZE - 1, (BATTLEFIELD_SIZE / 2 + 1 - enemy_count) + i * 2}, ENEMY_BASE_HP);
+	Rules rules = journal.rules();
+	int key;
+	long keys = 0;
+	if(delay_ms < 0) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		GameState state(journal.seed(), rules);
+		UndoHistory history;
+		while(!state.done() && journal.next(key)) {
+			history.step(state, key);
+			++keys;
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		printf("seed=%llu keys=%ld outcome=%s days_left=%d money=%d hash=%016llx time_us=%ld\n",
+				(unsigned long long)journal.seed(), keys, OUTCOME_NAMES[state.outcome],
+				state.days_left, state.money, (unsigned long long)fingerprint(state),
+				long(elapsed.count() * 1000000));
+		return 0;
 	}
-	std::vector<std::string> fightlog;
-	while(!done) {
-		erase();
-		for(int x = 0; x < fight_statusbar.width(); ++x) {
-			for(int y = 0; y < fight_statusbar.height(); ++y) {
-				mvaddch(y, LEFT_STATUS_BAR + x, fight_statusbar.cell(x, y));
-			}
-		}
-		for(int x = 0; x < battlefield.width(); ++x) {
-			for(int y = 0; y < battlefield.height(); ++y) {
-				draw_sprite(BATTLE_MAP, Chthon::Point(x, y), sprites[battlefield.cell(x, y)]);
-			}
-		}
-		draw_sprite(BATTLE_MAP, player.pos, sprites['@']);
-		for(const Character & enemy : enemies) {
-			draw_sprite(BATTLE_MAP, enemy.pos, sprites['A']);
-		}
-		mvprintw(1, LEFT_STATUS_BAR + 1, "HP: %d", player.hp);
-		int start_line = std::max(int(fightlog.size()) - FIGHTLOG_SIZE, 0);
-		for(int i = start_line; i < fightlog.size(); ++i) {
-			mvprintw(3 + i - start_line, LEFT_STATUS_BAR + 1, "%s", fightlog[i].c_str());
-		}
-
-		Chthon::Point shift;
-		while(true) {
-			char control = getch();
-			shift = get_shift(control);
-			switch(control) {
-				case 'q' : return false;
-			}
-			bool choice_made = !shift.null();
-            if(!choice_made) {
-                continue;
-            }
-			bool valid_pos = battlefield.valid(player.pos + shift);
-            if(valid_pos) {
-                bool not_forest = battlefield.cell(player.pos + shift) != '#';
-                if(not_forest) {
-                    break;
-                }
-            }
-		}
-
-		bool fought = false;
-		for(Character & enemy : enemies) {
-			if(player.pos + shift == enemy.pos && enemy.hp > 0) {
-				int damage = strength + rand() % PLAYER_DAMAGE_RANGE;
-				enemy.hp -= damage;
-				fightlog << Chthon::format("You hit enemy for {0} hp.", damage);
-				if(enemy.hp <= 0) {
-					fightlog << "Enemy is dead.";
-				}
-				fought = true;
-				break;
-			}
-		}
-		if(!fought) {
-			player.pos += shift;
-		}
 
-		enemies.erase(std::remove_if(
-					enemies.begin(), enemies.end(),
-					[](const Character & enemy){ return enemy.hp <= 0; }
-					), enemies.end());
-		Chthon::Pathfinder finder;
-		for(Character & enemy : enemies) {
-			bool ok = finder.lee(enemy.pos, player.pos,
-					[&](const Chthon::Point & p) {
-					if(p == enemy.pos) {
-						return true;
-					}
-					for(const Character & other : enemies) {
-						if(other.pos == p) {
-							return false;
-						}
-					}
-					return battlefield.valid(p) && battlefield.cell(p) == '.';
-					}
-					);
-			if(ok) {
-				Chthon::Point new_pos = enemy.pos + finder.directions.front();
-				if(new_pos == player.pos) {
-					int damage = rand() % ENEMY_DAMAGE_RANGE;
-					player.hp -= damage;
-					fightlog << Chthon::format("Enemy hit you for {0} hp.", damage);
-					if(player.hp <= 0) {
-						fightlog << "You are dead.";
-					}
-					if(player.hp <= 0) {
-						return false;
-					}
-				} else {
-					enemy.pos = new_pos;
-				}
-			}
-		}
-		if(enemies.empty()) {
-			return true;
-		}
+	std::string error = check_screen(rules);
+	if(!error.empty()) {
+		fprintf(stderr, "%s: %s Replay it without --delay.\n", filename.c_str(), error.c_str());
+		return 1;
 	}
-	return true;
-}
-
-void Game::map_mode()
-{
-	erase();
-	int shift = (80 - map.width()) / 2;
-	for(int x = 0; x < map.width(); ++x) {
-		for(int y = 0; y < map.height(); ++y) {
-			if(map.cell(x, y).seen) {
-				mvaddch(y, shift + x, minisprites[map.cell(x, y).sprite]);
-			}
-		}
+	std::unique_ptr<Terminal> term(create_terminal(ansi));
+	Game game(journal.seed(), *term, FORECAST_TIME_MS, rules);
+	game.start();
+	game.handle_key(' ');
+	game.draw();
+	while(journal.next(key) && game.handle_key(key)) {
+		game.draw();
+		term->show();
+		std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
 	}
-	mvaddch(player.y, shift + player.x, minisprites['@']);
-	while(getch() != 'm');
+	term->read_key();
+	return 0;
 }
 
-void Game::character_mode()
-{
-	erase();
-	while(true) {
-		int strength_cost = fibonacci(strength + 1) * 100;
-		int endurance_cost = fibonacci(endurance + 1) * 100;
-		mvprintw(0, 0, "Money: %d      ", money);
-		mvprintw(1, 0, "Strength: %d (%d to increase)", strength, strength_cost);
-		mvprintw(2, 0, "Endurance: %d (%d to increase)", endurance, endurance_cost);
-		mvprintw(3, 0, "Increase strength (a), increase endurance (b) or exit (space)");
-		int ch = getch();
-		switch(ch) {
-			case 'a':
-				if(money >= strength_cost) {
-					++strength;
-					money -= strength_cost;
-				} else {
-					mvprintw(4, 0, "Not enough money to increase strength! ");
-				}
-				break;
-			case 'b':
-				if(money >= endurance_cost) {
-					++endurance;
-					money -= endurance_cost;
-				} else {
-					mvprintw(4, 0, "Not enough money to increase endurance!");
-				}
-				break;
-			case ' ': case 'c': return;
+int main(int argc, char ** argv)
+{
+	uint64_t seed = time(NULL);
+	bool ansi = false;
+	Rules rules;
+	std::string address, record, replay_file, save_file = "wted.save";
+	int delay_ms = -1;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--seed" && i + 1 < argc) {
+			seed = strtoull(argv[++i], nullptr, 10);
+		} else if(arg == "--world" && i + 1 < argc) {
+			rules.world_size = atoi(argv[++i]);
+		} else if(arg == "--sight" && i + 1 < argc) {
+			rules.sight_radius = atoi(argv[++i]);
+		} else if(arg == "--battle" && i + 1 < argc) {
+			rules.battle_size = atoi(argv[++i]);
+		} else if(arg == "--puzzle" && i + 1 < argc) {
+			rules.puzzle_size = atoi(argv[++i]);
+		} else if(arg == "--probes") {
+			probes_enabled = true;
+		} else if(arg == "--ansi") {
+			ansi = true;
+		} else if(arg == "--serve" && i + 1 < argc) {
+			address = argv[++i];
+		} else if(arg == "--save" && i + 1 < argc) {
+			save_file = argv[++i];
+		} else if(arg == "--record" && i + 1 < argc) {
+			record = argv[++i];
+		} else if(arg == "--replay" && i + 1 < argc) {
+			replay_file = argv[++i];
+		} else if(arg == "--delay" && i + 1 < argc) {
+			delay_ms = std::max(0, atoi(argv[++i]));
+		} else {
+			fprintf(stderr, "Usage: %s [--seed N] [--world SIZE] [--sight N] [--battle SIZE] [--puzzle SIZE] [--ansi] [--record FILE] [--save FILE] [--probes]\n"
+					"       %s --serve SOCKET_PATH|[HOST]:PORT [--seed N] [--world SIZE] [--sight N] [--battle SIZE] [--puzzle SIZE] [--record DIR] [--probes]\n"
+					"       %s --replay FILE [--delay MS] [--ansi]\n",
+					argv[0], argv[0], argv[0]);
+			return 1;
 		}
 	}
-}
-
-Game::Game()
-	: map(MAP_SIZE, MAP_SIZE, '.'), puzzle(PUZZLE_SIZE, PUZZLE_SIZE, 0),
-	days_left(DAYS_LEFT), money(0), quit(false), strength(0), endurance(0)
-{
-	initscr();
-	raw();
-	keypad(stdscr, TRUE);
-	noecho();
-	start_color();
-	curs_set(0);
-
-
-	init_pair(1, COLOR_GREEN, COLOR_BLACK);
-	init_pair(2, COLOR_WHITE, COLOR_BLACK);
-	init_pair(3, COLOR_RED, COLOR_BLACK);
-	init_pair(4, COLOR_YELLOW, COLOR_BLACK);
-	minisprites[' '] = ' ';
-	minisprites['.'] = '"' | COLOR_PAIR(1);
-	minisprites['#'] = '#' | COLOR_PAIR(1) | A_BOLD;
-	minisprites['@'] = '@' | COLOR_PAIR(2) | A_BOLD;
-	minisprites['A'] = 'A' | COLOR_PAIR(3) | A_BOLD;
-	minisprites['*'] = '*' | COLOR_PAIR(4) | A_BOLD;
-	minisprites['X'] = 'X' | COLOR_PAIR(2) | A_BOLD;
-
-	Chthon::InterleavedCharMap sprites_data = { 9, 5, 6, {
-	"  '      ", "@@@@@@@@@", "    @    ",  "   38    ",  " /=====\\ ", "  \\   /  ", 
-	" '    '  ", "@@@@@@@@@", "   / \\ | ", "   ###   ",  "/       \\", "   \\ /   ", 
-	"  ' '    ", "@@@@@@@@@", "  /|_|\\+ ", " 3/#3/   ",  "+-------+",  "    X    ", 
-	" '  '  ' ", "@@@@@@@@@", "   | |   ",  "   S S\\  ", "|   9   |",  "   / \\   ", 
-	"     ;   ", " # # # # ", "   L L   ",  "   S S ^ ",  "L_______J",  "  /   \\  ", 
-	}};
-	sprites[' '] = Sprite(sprites_data.width, sprites_data.height, ' ');
-	sprites['.'] = Sprite(sprites_data.width, sprites_data.height, sprites_data.begin(0), sprites_data.end(0));
-	for(int & cell : sprites['.']) cell |= COLOR_PAIR(1);
-	sprites['#'] = Sprite(sprites_data.width, sprites_data.height, sprites_data.begin(1), sprites_data.end(1));
-	for(int & cell : sprites['#']) cell |= COLOR_PAIR(1) | A_BOLD;
-	sprites['@'] = Sprite(sprites_data.width, sprites_data.height, sprites_data.begin(2), sprites_data.end(2));
-	for(int & cell : sprites['@']) cell |= COLOR_PAIR(2) | A_BOLD;
-	sprites['A'] = Sprite(sprites_data.width, sprites_data.height, sprites_data.begin(3), sprites_data.end(3));
-	for(int & cell : sprites['A']) cell |= COLOR_PAIR(3) | A_BOLD;
-	sprites['*'] = Sprite(sprites_data.width, sprites_data.height, sprites_data.begin(4), sprites_data.end(4));
-	for(int & cell : sprites['*']) cell |= COLOR_PAIR(4) | A_BOLD;
-	sprites['X'] = Sprite(sprites_data.width, sprites_data.height, sprites_data.begin(5), sprites_data.end(5));
-	for(int & cell : sprites['X']) cell |= COLOR_PAIR(2) | A_BOLD;
-
-	const std::string statusbar_data = 
-		"+===========+===============================+"
-		"|Puzzle map |                               |"
-		"|           |                               |"
-		"|           |                               |"
-		"|           |                               |"
-		"|           |                               |"
-		"|           |                               |"
-		"+===========+===============================+"
-		"| (hjklyubn) Move                           |"
-		"| (m) Show map                              |"
-		"| (c) Character screen                      |"
-		"| (d) Dig for artifact (for 7 days)         |"
-		"|                                           |"
-		"| Walk onto enemy to fight with them.       |"
-		"| Walk onto treasure to collect it.         |"
-		"| Be careful not to fight with forces       |"
-		"| greater than you can handle.              |"
-		"| But do not waste any time! It's running   |"
-		"| out.                                      |"
-		"| Check map often. Once you're sure about   |"
-		"| artifact location, go there and dig.      |"
-		"| Don't forget to spend money on your       |"
-		"| character stats! It could reaaly help.    |"
-		"|                                           |"
-		"+===========================================+"
-		;
-	statusbar = Sprite(45, 25, statusbar_data.begin(), statusbar_data.end());
-
-	const std::string fight_statusbar_data = 
-		"+===========================================+"
-		"|                                           |"
-		"+===========================================+"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"|                                           |"
-		"+===========================================+"
-		"|                                           |"
-		"| (hjklyubn) Move                           |"
-		"| (q) Surrender and quit the game           |"
-		"|                                           |"
-		"| Walk onto enemy to fight with them.       |"
-		"| Use natural obstacles to fight enemies    |"
-		"| one by one.                               |"
-		"|                                           |"
-		"+===========================================+"
-		;
-	fight_statusbar = Sprite(45, 25, fight_statusbar_data.begin(), fight_statusbar_data.end());
-
-	for(int i = 0; i < MAP_SIZE * MAP_SIZE * 2 / 5; ++i) {
-		map.cell(rand() % MAP_SIZE, rand() % MAP_SIZE) = '#';
+	if(!replay_file.empty()) {
+		return replay(replay_file, delay_ms, ansi);
 	}
-	player = get_random_free_pos(map);
-	for(int i = 0; i < MAP_SIZE; ++i) {
-		map.cell(get_random_free_pos(map)) = '*';
+	rules.fit_enemy_count();
+	std::string error = rules.check();
+	if(error.empty()) {
+		error = check_screen(rules);
 	}
-	for(int i = 0; i < PUZZLE_SIZE * PUZZLE_SIZE; ++i) {
-		evil.push_back(Evil(get_random_free_pos(map, evil), 1 + rand() % MAX_ENEMY_COUNT));
+	if(!error.empty()) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
 	}
 
-	artifact = generate_value<Chthon::Point>(MAP_SIZE * MAP_SIZE,
-			[](){ return Chthon::Point(
-				PUZZLE_SIZE / 2 + rand() % (MAP_SIZE - PUZZLE_SIZE / 2),
-				PUZZLE_SIZE / 2 + rand() % (MAP_SIZE - PUZZLE_SIZE / 2)
-			); },
-			[this](const Chthon::Point & p){ return this->map.cell(p).sprite != '#'; }
-			);
-}
-
-int Game::run()
-{
-	const char * startup_screen =
-		"           ___________________________________________________________          \n"
-		"          /                                                        /_ \\         \n"
-		"          |                                                        |/ |         \n"
-		"          |     After a long, wasteful bloodshed that Evil brought |\\_/         \n"
-		"          | upon  peaceful eastern province,  it was defeated  and |            \n"
-		"          | discarded back  to the Empty Lands,  where it belongs. |            \n"
-		"          | No one  is dare  to  go  to  the  Empty Lands  without |            \n"
-		"          | legions  on their side.  But when  Evil  had  attacked |            \n"
-		"          | castle, it stole precious artifact, that was stored in |            \n"
-		"          | the abbey.  Lasandra's  Prism,  an  old  relic,  which |            \n"
-		"          | contains the soul of a saint.  It is an artifact, most |            \n"
-		"          | feared  by  the  Evil.  It  should  not be left in the |            \n"
-		"          | middle of the Empty Lands.  Your mission is to recover |            \n"
-		"          | that artifact.  And  stay alive,  of course.  No  more |            \n"
-		"          | man's blood should be spilled.  You must go there,  to |            \n"
-		"          | that strange and horrible land.                        |            \n"
-		"          |                                                        |            \n"
-		"          |                Where the Evil dwells.                  |            \n"
-		"          |                                                        |            \n"
-		"          |                                                        |            \n"
-		"          |                                                        |            \n"
-		"        __|_______________________________________________________ |            \n"
-		"       /                                                        / \\|            \n"
-		"       |                                                        |_/|            \n"
-		"       \\________________________________________________________\\__/            \n"
-		;
-	mvprintw(0, 0, "%s", startup_screen);
-	getch();
-
-	while(!quit) {
-		erase();
-		for(int x = 0; x < statusbar.width(); ++x) {
-			for(int y = 0; y < statusbar.height(); ++y) {
-				mvaddch(y, LEFT_STATUS_BAR + x, statusbar.cell(x, y));
-			}
-		}
-		mvprintw(1, LEFT_STATUS_BAR + 14, "Money: %d", money);
-		mvprintw(2, LEFT_STATUS_BAR + 14, "Days left: %d", days_left);
-		for(int x = -VIEW_RADIUS; x <= VIEW_RADIUS; ++x) {
-			for(int y = -VIEW_RADIUS; y <= VIEW_RADIUS; ++y) {
-				Chthon::Point pos = player + Chthon::Point(x, y);
-				int sprite = ' ';
-				if(map.valid(pos)) {
-					sprite = map.cell(pos).sprite;
-					map.cell(pos).seen = true;
-				}
-				draw_sprite(VIEW_MAP, Chthon::Point(x + 2, y + 2), sprites[sprite]);
-				for(const Evil & e : evil) {
-					if(e.pos == pos) {
-						draw_sprite(VIEW_MAP, Chthon::Point(x + 2, y + 2), sprites['A']);
-					}
-				}
-			}
-		}
-		draw_sprite(VIEW_MAP, Chthon::Point(2, 2), sprites['@']);
-
-		for(int x = -PUZZLE_RADIUS; x <= PUZZLE_RADIUS; ++x) {
-			for(int y = -PUZZLE_RADIUS; y <= PUZZLE_RADIUS; ++y) {
-				Chthon::Point pos = artifact + Chthon::Point(x, y);
-				int sprite = ' ';
-				if(map.valid(pos) && puzzle.cell(x + PUZZLE_RADIUS, y + PUZZLE_RADIUS)) {
-					sprite = map.cell(pos).sprite;
-				}
-				mvaddch(PUZZLE_CENTER.y + y, PUZZLE_CENTER.x + x, minisprites[sprite]);
-			}
-		}
-		mvaddch(PUZZLE_CENTER.y, PUZZLE_CENTER.x, minisprites['X']);
-
-		char control = getch();
-		Chthon::Point shift = get_shift(control);;
-		switch(control) {
-			case 'q' : quit = true; break;
-			case 'm' : map_mode(); break;
-			case 'c' : character_mode(); break;
-			case 'd':
-			{
-				if(player == artifact) {
-					artifact_found();
-					quit = true;
-				} else {
-					no_artifact_here();
-					days_left -= DAYS_FOR_DIGGING;
-				}
-				break;
-			}
-		}
-		if(!shift.null() && map.valid(player + shift) && map.cell(player + shift).sprite != '#') {
-			Chthon::Point new_player_pos = player + shift;
-			std::list<Evil>::iterator e;
-			e = std::find_if(evil.begin(), evil.end(),
-					[new_player_pos](const Evil & e) { return e.pos == new_player_pos; }
-					);
-			if(e != evil.end()) {
-				mvprintw(11, 25, "+----------------------------+");
-				mvprintw(12, 25, "|    There are %d enemies     |", e->count);
-				mvprintw(13, 25, "| Do you want to fight them? |");
-				mvprintw(14, 25, "|           (y/n)            |");
-				mvprintw(15, 25, "+----------------------------+");
-				int answer = 0;
-				while(answer != 'y' && answer != 'n') {
-					answer = getch();
-				}
-				if(answer == 'y') {
-					if(fight(e->count)) {
-						evil.erase(e);
-						player += shift;
-						money += BASE_MONEY_FOR_BATTLE + rand() % MAX_MONEY_FOR_ONE_ENEMY * e->count;
+	std::ofstream log_file("wted.log");
+	AsyncLog log(log_file);
+	AsyncLogStream chthon_log(log);
+	Chthon::direct_log(&chthon_log);
+	log.text("Seed: " + std::to_string(seed));
+	struct sigaction toggle;
+	memset(&toggle, 0, sizeof(toggle));
+	toggle.sa_handler = toggle_probes;
+	toggle.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &toggle, nullptr);
+
+	if(!address.empty()) {
+		Server server(seed, rules, log, record);
+		if(!server.listen(address)) {
+			return 1;
+		}
+		return server.run();
+	}
 
-						Chthon::Point piece = generate_value<Chthon::Point>(PUZZLE_SIZE * PUZZLE_SIZE,
-								[](){ return Chthon::Point(rand() % PUZZLE_SIZE, rand() % PUZZLE_SIZE); },
-								[this](const Chthon::Point & p){ return !this->puzzle.cell(p); }
-								);
-						puzzle.cell(piece) = 1;
-					} else {
-						player_died();
-						quit = true;
-					}
-				}
-			} else {
-				player += shift;
-			}
-			--days_left;
-			if(days_left <= 0) {
-				time_ran_out();
-				quit = true;
-			}
-		}
-		if(map.cell(player).sprite == '*') {
-			money += TREASURE_MONEY;
-			map.cell(player) = '.';
+	std::unique_ptr<Terminal> term(create_terminal(ansi));
+	Game game(seed, *term, FORECAST_TIME_MS, rules);
+	// A resumed game cannot be replayed from its first key, so it is not recorded.
+	std::unique_ptr<JournalWriter> journal;
+	if(game.resume(save_file)) {
+		log.text("Resumed " + save_file);
+	} else {
+		journal.reset(new JournalWriter(record.empty() ? "wted.journal" : record, seed, rules));
+		if(journal->is_open()) {
+			game.set_journal(journal.get());
 		}
 	}
-	return 0;
-}
-
-Game::~Game()
-{
-	cbreak();
-	echo();
-	curs_set(1);
-	endwin();
-}
-
-int main()
-{
-	std::ofstream log_file("wted.log");
-	Chthon::direct_log(&log_file);
-	srand(time(NULL));
-
-	Game game;
-	return game.run();
+	game.set_save_file(save_file);
+	game.set_log(&log);
+	int result = game.run();
+	for(const std::string & line : probe_summary()) {
+		log.text(line);
+	}
+	return result;
 }
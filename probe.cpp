@@ -0,0 +1,72 @@
+#include "probe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+std::atomic<bool> probes_enabled(false);
+
+namespace {
+
+enum {
+	BUCKET_COUNT = 64
+};
+
+const char * PROBE_NAMES[PROBE_COUNT] = { "rules", "draw", "output", "input_to_paint", "pathing" };
+
+std::atomic<uint64_t> histograms[PROBE_COUNT][BUCKET_COUNT];
+std::atomic<uint64_t> totals[PROBE_COUNT];
+
+// Upper bound of the bucket that holds the given share of the samples.
+uint64_t percentile(ProbeId probe, uint64_t count, int percent)
+{
+	uint64_t wanted = (count * percent + 99) / 100;
+	uint64_t seen = 0;
+	for(int bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+		seen += histograms[probe][bucket].load(std::memory_order_relaxed);
+		if(seen >= wanted) {
+			return bucket == BUCKET_COUNT - 1 ? UINT64_MAX : (uint64_t(2) << bucket) - 1;
+		}
+	}
+	return 0;
+}
+
+}
+
+uint64_t probe_clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record_probe(ProbeId probe, uint64_t ns)
+{
+	int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+	histograms[probe][bucket].fetch_add(1, std::memory_order_relaxed);
+	totals[probe].fetch_add(ns, std::memory_order_relaxed);
+}
+
+std::vector<std::string> probe_summary()
+{
+	std::vector<std::string> lines;
+	for(int probe = 0; probe < PROBE_COUNT; ++probe) {
+		uint64_t count = 0;
+		for(int bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+			count += histograms[probe][bucket].load(std::memory_order_relaxed);
+		}
+		if(count == 0) {
+			continue;
+		}
+		ProbeId id = ProbeId(probe);
+		char line[256];
+		snprintf(line, sizeof(line), "probe %s: count=%llu mean_ns=%llu p50_ns<=%llu p90_ns<=%llu p99_ns<=%llu max_ns<=%llu",
+				PROBE_NAMES[probe], (unsigned long long)count,
+				(unsigned long long)(totals[probe].load(std::memory_order_relaxed) / count),
+				(unsigned long long)percentile(id, count, 50),
+				(unsigned long long)percentile(id, count, 90),
+				(unsigned long long)percentile(id, count, 99),
+				(unsigned long long)percentile(id, count, 100));
+		lines.push_back(line);
+	}
+	return lines;
+}
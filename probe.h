@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Timing probes. While they are off a probe costs one relaxed atomic load;
+// while they are on, durations go into log2 histograms, and frame timings
+// go into the log. --probes starts with them on, SIGUSR1 toggles them.
+enum ProbeId {
+	PROBE_RULES,
+	PROBE_DRAW,
+	PROBE_OUTPUT,
+	PROBE_INPUT_TO_PAINT,
+	PROBE_PATHING,
+	PROBE_COUNT
+};
+
+extern std::atomic<bool> probes_enabled;
+
+uint64_t probe_clock();
+void record_probe(ProbeId probe, uint64_t ns);
+// Histogram summary, one line per probe that has recorded anything.
+std::vector<std::string> probe_summary();
+// Heap allocations made by the calling thread so far. Defined with AsyncLog
+// and FrameProbe in frame_probe.cpp, which replaces the plain and array
+// forms of operator new to count them and is linked only into wted and
+// wted-bench. They are counted even while probes are off, at the cost of
+// a thread-local increment per allocation.
+long thread_allocations();
+
+class Probe {
+public:
+	explicit Probe(ProbeId probe_id)
+		: id(probe_id), start(probes_enabled.load(std::memory_order_relaxed) ? probe_clock() : 0)
+	{}
+	~Probe()
+	{
+		if(start) {
+			record_probe(id, probe_clock() - start);
+		}
+	}
+private:
+	ProbeId id;
+	uint64_t start;
+};
+
+struct FrameRecord {
+	uint64_t frame;
+	uint32_t ns[PROBE_COUNT];
+	long allocations;
+};
+
+// Log writer with a background flush thread. The producer side is one
+// thread (the one running the game loop) and never waits: entries go
+// into a fixed lock-free ring and are dropped if the ring is full.
+class AsyncLog {
+public:
+	AsyncLog(std::ostream & log_out);
+	~AsyncLog();
+	void text(const std::string & line);
+	void frame(const FrameRecord & record);
+private:
+	enum { CAPACITY = 1024, TEXT_SIZE = 120 };
+	struct Entry {
+		bool is_frame;
+		FrameRecord record;
+		char text[TEXT_SIZE];
+	};
+
+	std::ostream & out;
+	std::vector<Entry> entries;
+	std::atomic<unsigned> head, tail;
+	std::atomic<unsigned long> dropped;
+	unsigned long reported_dropped;
+	std::atomic<bool> stopping;
+	std::mutex wake_lock;
+	std::condition_variable wake;
+	std::thread flusher;
+
+	Entry * reserve();
+	void commit();
+	void flush_loop();
+	void drain();
+};
+
+// Stream for code that logs to an ostream, such as Chthon, on the game
+// loop thread. Every line goes to the log as text, so only the flush
+// thread ever writes to the file.
+class AsyncLogStream : public std::ostream {
+public:
+	AsyncLogStream(AsyncLog & target_log);
+private:
+	struct Buffer : std::streambuf {
+		AsyncLog & log;
+		std::string line;
+		Buffer(AsyncLog & target_log) : log(target_log) {}
+		int overflow(int c);
+	};
+	Buffer buffer;
+};
+
+// Times the stages of one frame, from the moment its first key arrived.
+class FrameProbe {
+public:
+	FrameProbe();
+	void lap(ProbeId probe);
+	void finish(AsyncLog * log);
+private:
+	bool enabled;
+	uint64_t start, last;
+	long allocations;
+	FrameRecord record;
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+
+// SplitMix64 generator. Every game owns one, so games are reproducible
+// from their seed and never share state between threads.
+// split() derives an independent stream, e.g. for a single battle.
+class Random {
+public:
+	explicit Random(uint64_t random_seed = 0, uint64_t random_gamma = GOLDEN_GAMMA)
+		: seed(random_seed), gamma(random_gamma)
+	{}
+	uint64_t next()
+	{
+		return mix64(seed += gamma);
+	}
+	uint32_t next32()
+	{
+		return uint32_t(next() >> 32);
+	}
+	// Unbiased value in [0, bound), Lemire's multiply-and-reject.
+	int range(int bound)
+	{
+		uint32_t n = uint32_t(bound);
+		uint64_t m = uint64_t(next32()) * n;
+		if(uint32_t(m) < n) {
+			uint32_t threshold = -n % n;
+			while(uint32_t(m) < threshold) {
+				m = uint64_t(next32()) * n;
+			}
+		}
+		return int(m >> 32);
+	}
+	Random split()
+	{
+		uint64_t child_seed = next();
+		return Random(child_seed, mix_gamma(seed += gamma));
+	}
+private:
+	static const uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15ULL;
+	uint64_t seed, gamma;
+
+	static uint64_t mix64(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+	static uint64_t mix_gamma(uint64_t z)
+	{
+		z = (z ^ (z >> 33)) * 0xff51afd7ed558ccdULL;
+		z = (z ^ (z >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+		z = (z ^ (z >> 33)) | 1;
+		int transitions = __builtin_popcountll(z ^ (z >> 1));
+		return transitions < 24 ? z ^ 0xaaaaaaaaaaaaaaaaULL : z;
+	}
+};
@@ -0,0 +1,320 @@
+#include "save.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+namespace {
+
+const char MAGIC[] = { 'W', 'T', 'S', 'V' };
+const uint32_t VERSION = 6;
+
+static_assert(std::is_trivially_copyable<Random>::value, "Random is saved as it is.");
+
+struct SaveHeader {
+	char magic[sizeof(MAGIC)];
+	uint32_t version;
+	uint32_t header_size;
+	int32_t rules_days_left, rules_max_enemy_count, rules_base_money_for_battle, rules_stat_cost, rules_world_size, rules_sight_radius;
+	int32_t rules_battle_size, rules_puzzle_size;
+	uint64_t seed;
+	int32_t player_x, player_y, artifact_x, artifact_y, destination_x, destination_y;
+	int32_t days_left, money, strength, endurance;
+	int32_t mode, message, outcome;
+	int32_t missing_count;
+	int32_t evil_size;
+	// Row by row, rules_puzzle_size cells a row.
+	int8_t puzzle[MAX_PUZZLE_SIZE * MAX_PUZZLE_SIZE];
+	int8_t missing_pieces[MAX_PUZZLE_SIZE * MAX_PUZZLE_SIZE];
+	char random[sizeof(Random)];
+	uint64_t battle_forest, battle_occupied;
+	int32_t battle_size, battle_player, battle_player_hp, battle_enemy_count;
+	int32_t battle_enemies[Battle::MAX_ENEMIES], battle_enemy_hp[Battle::MAX_ENEMIES];
+	// Kept events of the fight log, oldest first.
+	uint32_t battle_event_count;
+	int32_t battle_event_types[FightLog::CAPACITY], battle_event_damage[FightLog::CAPACITY];
+	char battle_random[sizeof(Random)];
+};
+
+size_t aligned(size_t size)
+{
+	return (size + 7) / 8 * 8;
+}
+
+// Evil groups and then the world go after the header at 8-byte boundaries.
+const size_t EVIL_OFFSET = aligned(sizeof(SaveHeader));
+
+// Stats cost Fibonacci numbers of money, no game gets anywhere near.
+const int MAX_STAT = 30;
+
+// Cells and counts of a saved battle are used as indices and shifts.
+bool valid_battle(const Battle & battle, int endurance)
+{
+	if(battle.size < MIN_BATTLEFIELD_SIZE || battle.size > MAX_BATTLEFIELD_SIZE
+			|| battle.enemy_count < 0 || battle.enemy_count > Battle::MAX_ENEMIES
+			|| battle.player < 0 || battle.player >= battle.size * battle.size
+			|| battle.player_hp < 0 || battle.player_hp - PLAYER_BASE_HP > endurance) {
+		return false;
+	}
+	Board outside = ~Board(0) << (battle.size * battle.size - 1) << 1;
+	Board enemies = 0;
+	for(int i = 0; i < battle.enemy_count; ++i) {
+		if(battle.enemies[i] < 0 || battle.enemies[i] >= battle.size * battle.size
+				|| battle.enemy_hp[i] <= 0 || battle.enemy_hp[i] > ENEMY_BASE_HP
+				|| (enemies & Battle::bit(battle.enemies[i]))) {
+			return false;
+		}
+		enemies |= Battle::bit(battle.enemies[i]);
+	}
+	return battle.occupied == enemies && !(battle.forest & outside);
+}
+
+void write_battle(const Battle & battle, SaveHeader & header)
+{
+	header.battle_forest = battle.forest;
+	header.battle_occupied = battle.occupied;
+	header.battle_size = battle.size;
+	header.battle_player = battle.player;
+	header.battle_player_hp = battle.player_hp;
+	header.battle_enemy_count = battle.enemy_count;
+	for(int i = 0; i < battle.enemy_count; ++i) {
+		header.battle_enemies[i] = battle.enemies[i];
+		header.battle_enemy_hp[i] = battle.enemy_hp[i];
+	}
+	header.battle_event_count = battle.fightlog.count();
+	for(unsigned i = 0; i < battle.fightlog.size(); ++i) {
+		header.battle_event_types[i] = battle.fightlog[i].type;
+		header.battle_event_damage[i] = battle.fightlog[i].damage;
+	}
+	memcpy(header.battle_random, &battle.random, sizeof(Random));
+}
+
+// Returns false if a value does not fit into its field of Battle, the
+// rest is up to valid_battle().
+bool read_battle(const SaveHeader & header, Battle & battle)
+{
+	battle.forest = header.battle_forest;
+	battle.occupied = header.battle_occupied;
+	battle.size = header.battle_size;
+	battle.player = header.battle_player;
+	battle.player_hp = header.battle_player_hp;
+	battle.enemy_count = header.battle_enemy_count;
+	if(battle.size != header.battle_size || battle.player != header.battle_player
+			|| battle.player_hp != header.battle_player_hp || battle.enemy_count != header.battle_enemy_count
+			|| header.battle_enemy_count < 0 || header.battle_enemy_count > Battle::MAX_ENEMIES) {
+		return false;
+	}
+	for(int i = 0; i < battle.enemy_count; ++i) {
+		battle.enemies[i] = header.battle_enemies[i];
+		battle.enemy_hp[i] = header.battle_enemy_hp[i];
+		if(battle.enemies[i] != header.battle_enemies[i] || battle.enemy_hp[i] != header.battle_enemy_hp[i]) {
+			return false;
+		}
+	}
+	std::vector<FightEvent> kept;
+	for(unsigned i = 0; i < std::min<unsigned>(header.battle_event_count, FightLog::CAPACITY); ++i) {
+		FightEvent event(header.battle_event_types[i], header.battle_event_damage[i]);
+		if(event.type != header.battle_event_types[i] || event.damage != header.battle_event_damage[i]
+				|| event.type < FightEvent::NONE || event.type > FightEvent::PLAYER_DIED) {
+			return false;
+		}
+		kept.push_back(event);
+	}
+	battle.fightlog = FightLog(header.battle_event_count, kept);
+	memcpy(&battle.random, header.battle_random, sizeof(Random));
+	return true;
+}
+
+// Empty if the file cannot be read.
+std::shared_ptr<const void> map_file(const std::string & filename, size_t & size)
+{
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return nullptr;
+	}
+	struct stat file_stat;
+	void * data = MAP_FAILED;
+	if(fstat(fd, &file_stat) == 0 && size_t(file_stat.st_size) >= EVIL_OFFSET) {
+		data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(data == MAP_FAILED) {
+		return nullptr;
+	}
+	size_t mapped_size = file_stat.st_size;
+	size = mapped_size;
+	return std::shared_ptr<const void>(data, [mapped_size](const void * p) { munmap(const_cast<void *>(p), mapped_size); });
+}
+
+}
+
+bool save_game(GameState & state, const std::string & filename)
+{
+	SaveHeader header;
+	memset(&header, 0, sizeof(header));
+	std::copy(MAGIC, MAGIC + sizeof(MAGIC), header.magic);
+	header.version = VERSION;
+	header.header_size = sizeof(header);
+	header.rules_days_left = state.rules.days_left;
+	header.rules_max_enemy_count = state.rules.max_enemy_count;
+	header.rules_base_money_for_battle = state.rules.base_money_for_battle;
+	header.rules_stat_cost = state.rules.stat_cost;
+	header.rules_world_size = state.rules.world_size;
+	header.rules_sight_radius = state.rules.sight_radius;
+	header.rules_battle_size = state.rules.battle_size;
+	header.rules_puzzle_size = state.rules.puzzle_size;
+	header.seed = state.seed;
+	header.player_x = state.player.x;
+	header.player_y = state.player.y;
+	header.artifact_x = state.artifact.x;
+	header.artifact_y = state.artifact.y;
+	header.destination_x = state.destination.x;
+	header.destination_y = state.destination.y;
+	header.days_left = state.days_left;
+	header.money = state.money;
+	header.strength = state.strength;
+	header.endurance = state.endurance;
+	header.mode = state.mode;
+	header.message = state.message;
+	header.outcome = state.outcome;
+	int side = state.rules.puzzle_size;
+	for(int y = 0; y < side; ++y) {
+		for(int x = 0; x < side; ++x) {
+			header.puzzle[y * side + x] = state.puzzle.cell(x, y);
+		}
+	}
+	const std::vector<int> & missing = state.missing_pieces.order();
+	header.missing_count = missing.size();
+	std::copy(missing.begin(), missing.end(), header.missing_pieces);
+	memcpy(header.random, &state.random, sizeof(Random));
+	write_battle(state.battle, header);
+	std::vector<int32_t> evil = state.evil.pack();
+	header.evil_size = evil.size();
+	size_t world_offset = EVIL_OFFSET + aligned(evil.size() * sizeof(int32_t));
+
+	// A save killed halfway should not replace the previous one.
+	std::string temp_filename = filename + ".tmp";
+	{
+		std::ofstream out(temp_filename.c_str(), std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		for(size_t i = sizeof(header); i < EVIL_OFFSET; ++i) {
+			out.put(0);
+		}
+		out.write(reinterpret_cast<const char *>(evil.data()), evil.size() * sizeof(int32_t));
+		for(size_t i = EVIL_OFFSET + evil.size() * sizeof(int32_t); i < world_offset; ++i) {
+			out.put(0);
+		}
+		state.map.save(out);
+		if(!out.flush()) {
+			return false;
+		}
+	}
+	if(rename(temp_filename.c_str(), filename.c_str()) != 0) {
+		return false;
+	}
+	size_t size = 0;
+	std::shared_ptr<const void> storage = map_file(filename, size);
+	if(storage && size >= world_offset) {
+		state.map.reload(static_cast<const char *>(storage.get()) + world_offset, size - world_offset, storage);
+	}
+	return true;
+}
+
+bool load_game(GameState & state, const std::string & filename)
+{
+	size_t size = 0;
+	std::shared_ptr<const void> storage = map_file(filename, size);
+	if(!storage) {
+		return false;
+	}
+	const char * bytes = static_cast<const char *>(storage.get());
+
+	SaveHeader header;
+	memcpy(&header, bytes, sizeof(header));
+	if(!std::equal(MAGIC, MAGIC + sizeof(MAGIC), header.magic) || header.version != VERSION
+			|| header.header_size != sizeof(header)) {
+		return false;
+	}
+	Rules rules;
+	rules.days_left = header.rules_days_left;
+	rules.max_enemy_count = header.rules_max_enemy_count;
+	rules.base_money_for_battle = header.rules_base_money_for_battle;
+	rules.stat_cost = header.rules_stat_cost;
+	rules.world_size = header.rules_world_size;
+	rules.sight_radius = header.rules_sight_radius;
+	rules.battle_size = header.rules_battle_size;
+	rules.puzzle_size = header.rules_puzzle_size;
+	Battle battle;
+	if(!rules.check().empty() || !read_battle(header, battle)) {
+		return false;
+	}
+	int puzzle_area = rules.puzzle_size * rules.puzzle_size;
+	if(header.outcome != GameState::PLAYING
+			|| header.days_left <= 0 || header.money < 0
+			|| header.strength < 0 || header.strength > MAX_STAT
+			|| header.endurance < 0 || header.endurance > MAX_STAT || !valid_battle(battle, header.endurance)
+			|| header.mode < GameState::TRAVEL || header.mode > GameState::MESSAGE
+			|| header.message < GameState::NO_MESSAGE || header.message > GameState::NOT_ENOUGH_FOR_ENDURANCE
+			|| header.missing_count < 0 || header.missing_count > puzzle_area
+			|| header.evil_size < 0 || size_t(header.evil_size) > (size - EVIL_OFFSET) / sizeof(int32_t)) {
+		return false;
+	}
+	const int32_t * evil_data = reinterpret_cast<const int32_t *>(bytes + EVIL_OFFSET);
+	std::vector<int32_t> evil(evil_data, evil_data + header.evil_size);
+	size_t world_offset = EVIL_OFFSET + aligned(evil.size() * sizeof(int32_t));
+	std::vector<bool> missing(puzzle_area, false);
+	for(int i = 0; i < header.missing_count; ++i) {
+		if(header.missing_pieces[i] < 0 || header.missing_pieces[i] >= puzzle_area || missing[header.missing_pieces[i]]) {
+			return false;
+		}
+		missing[header.missing_pieces[i]] = true;
+	}
+	World map;
+	if(world_offset > size || !map.load(bytes + world_offset, size - world_offset, storage)
+			|| map.width() != rules.world_size) {
+		return false;
+	}
+	Evil groups;
+	if(!groups.unpack(evil, map.width(), rules.days_left - header.days_left)) {
+		return false;
+	}
+	Chthon::Point player(header.player_x, header.player_y), destination(header.destination_x, header.destination_y);
+	Chthon::Point artifact(header.artifact_x, header.artifact_y);
+	if(!map.valid(player) || !map.valid(destination) || !map.valid(artifact)) {
+		return false;
+	}
+
+	state.map = map;
+	state.rules = rules;
+	state.seed = header.seed;
+	state.player = player;
+	state.artifact = artifact;
+	state.destination = destination;
+	state.days_left = header.days_left;
+	state.money = header.money;
+	state.strength = header.strength;
+	state.endurance = header.endurance;
+	state.mode = GameState::Mode(header.mode);
+	state.message = GameState::Message(header.message);
+	state.outcome = GameState::PLAYING;
+	int side = rules.puzzle_size;
+	state.puzzle = Chthon::Map<char>(side, side, 0);
+	for(int y = 0; y < side; ++y) {
+		for(int x = 0; x < side; ++x) {
+			state.puzzle.cell(x, y) = header.puzzle[y * side + x];
+		}
+	}
+	state.missing_pieces = FreeCells(side, side);
+	state.missing_pieces.restore(std::vector<int>(header.missing_pieces, header.missing_pieces + header.missing_count));
+	memcpy(&state.random, header.random, sizeof(Random));
+	state.battle = battle;
+	state.fov = Fov(state.rules.sight_radius);
+	state.reveal();
+	state.evil = groups;
+	return true;
+}
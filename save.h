@@ -0,0 +1,16 @@
+#pragma once
+#include "game.h"
+#include <string>
+
+// Versioned binary save of a game in progress: a fixed header with
+// everything but the world, then the world with its explored chunks as
+// packed bitplanes (see World::save()). Loading maps the file and reads
+// the chunks from there in place, so it takes the same time whatever
+// the size of the world.
+// Saves are not portable between architectures; a file with another
+// layout is refused by its header size.
+// The world of the state then reads its explored chunks from the new save,
+// so the next save copies them rather than generating them again.
+bool save_game(GameState & state, const std::string & filename);
+// Returns false if there is no save or it cannot be used.
+bool load_game(GameState & state, const std::string & filename);
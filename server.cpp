@@ -0,0 +1,232 @@
+#include "server.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+enum {
+	MAX_EVENTS = 256,
+	INPUT_BUFFER_SIZE = 256,
+	// A stalled forecast would stall every other session too.
+	SESSION_FORECAST_TIME_MS = 10
+};
+
+Server::Server(uint64_t server_seed, const Rules & server_rules, AsyncLog & server_log, const std::string & server_journal_dir)
+	: seeds(server_seed), rules(server_rules), log(server_log), listener(-1), epoll(-1), tcp(false), journal_dir(server_journal_dir)
+{
+}
+
+Server::~Server()
+{
+	while(!sessions.empty()) {
+		close_session(sessions.begin()->first);
+	}
+	if(epoll >= 0) {
+		close(epoll);
+	}
+	if(listener >= 0) {
+		close(listener);
+	}
+	if(!socket_path.empty()) {
+		unlink(socket_path.c_str());
+	}
+}
+
+bool Server::listen(const std::string & address)
+{
+	size_t colon = address.rfind(':');
+	tcp = colon != std::string::npos;
+	if(tcp) {
+		std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		addrinfo * addresses = nullptr;
+		int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+		if(error) {
+			fprintf(stderr, "%s: %s\n", address.c_str(), gai_strerror(error));
+			return false;
+		}
+		for(addrinfo * a = addresses; a && listener < 0; a = a->ai_next) {
+			listener = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+			if(listener < 0) {
+				continue;
+			}
+			int on = 1;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			if(bind(listener, a->ai_addr, a->ai_addrlen) < 0) {
+				close(listener);
+				listener = -1;
+			}
+		}
+		freeaddrinfo(addresses);
+	} else {
+		sockaddr_un local;
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		if(address.size() >= sizeof(local.sun_path)) {
+			fprintf(stderr, "%s: socket path is too long\n", address.c_str());
+			return false;
+		}
+		strcpy(local.sun_path, address.c_str());
+		unlink(address.c_str());
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(listener >= 0 && bind(listener, (sockaddr*)&local, sizeof(local)) < 0) {
+			close(listener);
+			listener = -1;
+		}
+		if(listener >= 0) {
+			socket_path = address;
+		}
+	}
+	if(listener < 0 || ::listen(listener, SOMAXCONN) < 0) {
+		fprintf(stderr, "%s: %s\n", address.c_str(), strerror(errno));
+		return false;
+	}
+	log.text("Listening on " + address);
+	return true;
+}
+
+int Server::run()
+{
+	signal(SIGPIPE, SIG_IGN);
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+	if(epoll < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
+	watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+
+	epoll_event events[MAX_EVENTS];
+	while(true) {
+		int count = epoll_wait(epoll, events, MAX_EVENTS, -1);
+		if(count < 0 && errno == EINTR) {
+			continue;
+		}
+		if(count < 0) {
+			perror("epoll_wait");
+			return 1;
+		}
+		for(int i = 0; i < count; ++i) {
+			if(events[i].data.fd == listener) {
+				accept_sessions();
+			} else {
+				handle(events[i].data.fd, events[i].events);
+			}
+		}
+	}
+}
+
+void Server::accept_sessions()
+{
+	while(true) {
+		int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("accept4");
+			}
+			return;
+		}
+		if(tcp) {
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		}
+		uint64_t seed = seeds.next();
+		log.text("Session " + std::to_string(fd) + " seed: " + std::to_string(seed));
+
+		Session & session = sessions[fd];
+		session.term.reset(new AnsiTerminal(fd, SCREEN_WIDTH, SCREEN_HEIGHT));
+		session.game.reset(new Game(seed, *session.term, SESSION_FORECAST_TIME_MS, rules));
+		if(!journal_dir.empty()) {
+			std::string filename = journal_dir + "/session-" + std::to_string(seed) + ".journal";
+			session.journal.reset(new JournalWriter(filename, seed, rules));
+			if(session.journal->is_open()) {
+				session.game->set_journal(session.journal.get());
+			} else {
+				log.text("Cannot write journal " + filename);
+			}
+		}
+		session.game->start();
+		session.term->flush();
+		session.writing = session.term->output_pending();
+		watch(fd, session.writing ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_ADD);
+	}
+}
+
+void Server::handle(int fd, unsigned events)
+{
+	std::map<int, Session>::iterator found = sessions.find(fd);
+	if(found == sessions.end()) {
+		return;
+	}
+	Session & session = found->second;
+	if(events & (EPOLLERR | EPOLLHUP)) {
+		close_session(fd);
+		return;
+	}
+	FrameProbe frame;
+	// A read interrupted or with nothing to read yet has no keys to show.
+	bool handled = false;
+	if(events & EPOLLIN) {
+		char keys[INPUT_BUFFER_SIZE];
+		ssize_t count = read(fd, keys, sizeof(keys));
+		if(count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR)) {
+			close_session(fd);
+			return;
+		}
+		handled = count > 0;
+		for(ssize_t i = 0; i < count; ++i) {
+			if(!session.game->handle_key((unsigned char)keys[i])) {
+				close_session(fd);
+				return;
+			}
+			if(session.game->prompting() && i + 1 < count) {
+				session.game->draw();
+				session.term->flush();
+			}
+		}
+	}
+	if(handled) {
+		// Sessions have no save file, this only flushes the journal.
+		session.game->save();
+		frame.lap(PROBE_RULES);
+		session.game->draw();
+		frame.lap(PROBE_DRAW);
+	}
+	session.term->flush();
+	if(handled) {
+		frame.lap(PROBE_OUTPUT);
+		frame.finish(&log);
+	}
+	bool writing = session.term->output_pending();
+	if(writing != session.writing) {
+		session.writing = writing;
+		watch(fd, writing ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+	}
+}
+
+void Server::close_session(int fd)
+{
+	log.text("Session " + std::to_string(fd) + " closed");
+	epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+	sessions.erase(fd);
+	close(fd);
+}
+
+void Server::watch(int fd, unsigned events, int operation)
+{
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.fd = fd;
+	epoll_ctl(epoll, operation, fd, &event);
+}
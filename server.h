@@ -0,0 +1,40 @@
+#pragma once
+#include "ui.h"
+#include <map>
+#include <memory>
+#include <string>
+
+// Hosts many games in one process. Clients connect with a raw terminal
+// (e.g. socat -,raw,echo=0 UNIX-CONNECT:PATH) to a Unix socket or to
+// HOST:PORT over TCP, and every connection plays its own game.
+// A single epoll loop feeds their keys to the games and sends back only
+// the changed parts of their screens.
+class Server {
+public:
+	// Sessions are recorded into journal_dir if it is set.
+	Server(uint64_t server_seed, const Rules & server_rules, AsyncLog & server_log, const std::string & server_journal_dir = std::string());
+	~Server();
+	bool listen(const std::string & address);
+	int run();
+private:
+	struct Session {
+		std::unique_ptr<JournalWriter> journal;
+		std::unique_ptr<AnsiTerminal> term;
+		std::unique_ptr<Game> game;
+		bool writing;
+	};
+
+	Random seeds;
+	Rules rules;
+	AsyncLog & log;
+	int listener, epoll;
+	bool tcp;
+	std::string socket_path;
+	std::string journal_dir;
+	std::map<int, Session> sessions;
+
+	void accept_sessions();
+	void handle(int fd, unsigned events);
+	void close_session(int fd);
+	void watch(int fd, unsigned events, int operation);
+};
@@ -0,0 +1,296 @@
+#include "game.h"
+#include "bot.h"
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+
+enum {
+	DEFAULT_GAME_COUNT = 1000,
+	BATCH_SIZE = 16,
+	MONEY_CURVE_POINTS = 10
+};
+
+struct Batch {
+	int first, last;
+	Batch(int batch_first = 0, int batch_last = 0)
+		: first(batch_first), last(batch_last)
+	{}
+};
+
+// Batches of one worker. The owner takes them from the back,
+// idle workers steal from the front.
+class WorkQueue {
+public:
+	void push(const Batch & batch)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		batches.push_back(batch);
+	}
+	bool pop(Batch & batch)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if(batches.empty()) {
+			return false;
+		}
+		batch = batches.back();
+		batches.pop_back();
+		return true;
+	}
+	bool steal(Batch & batch)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if(batches.empty()) {
+			return false;
+		}
+		batch = batches.front();
+		batches.pop_front();
+		return true;
+	}
+private:
+	std::mutex lock;
+	std::deque<Batch> batches;
+};
+
+struct Stats {
+	long games;
+	long steps;
+	long outcomes[GameState::QUIT + 1];
+	long days_used;
+	std::vector<long> killed_by;
+	std::vector<long long> money_by_day;
+	std::vector<long> games_by_day;
+
+	Stats(const Rules & rules)
+		: games(0), steps(0), days_used(0),
+		killed_by(rules.max_enemy_count + 1, 0),
+		money_by_day(rules.days_left + 1, 0), games_by_day(rules.days_left + 1, 0)
+	{
+		std::fill(outcomes, outcomes + GameState::QUIT + 1, 0);
+	}
+	void merge(const Stats & other)
+	{
+		games += other.games;
+		steps += other.steps;
+		days_used += other.days_used;
+		for(int i = 0; i <= GameState::QUIT; ++i) {
+			outcomes[i] += other.outcomes[i];
+		}
+		for(unsigned i = 0; i < killed_by.size(); ++i) {
+			killed_by[i] += other.killed_by[i];
+		}
+		for(unsigned i = 0; i < money_by_day.size(); ++i) {
+			money_by_day[i] += other.money_by_day[i];
+			games_by_day[i] += other.games_by_day[i];
+		}
+	}
+};
+
+void play(uint64_t seed, const Rules & rules, const Bot & bot, Stats & stats)
+{
+	GameState state(seed, rules);
+	Bot player = bot;
+	int enemy_count = 0;
+	int day = 0;
+	while(!state.done()) {
+		if(state.mode == GameState::ENCOUNTER) {
+			enemy_count = state.encountered();
+		}
+		state.step(player.act(state));
+		++stats.steps;
+		int today = std::min(rules.days_left, rules.days_left - state.days_left);
+		for(; day < today; ++day) {
+			stats.money_by_day[day] += state.money;
+			++stats.games_by_day[day];
+		}
+	}
+	++stats.games;
+	++stats.outcomes[state.outcome];
+	stats.days_used += rules.days_left - std::max(0, state.days_left);
+	if(state.outcome == GameState::DIED) {
+		++stats.killed_by[enemy_count];
+	}
+}
+
+Stats simulate(uint64_t seed, const Rules & rules, const Bot & bot, int game_count, int thread_count)
+{
+	std::vector<WorkQueue> queues(thread_count);
+	int batch_count = 0;
+	for(int first = 0; first < game_count; first += BATCH_SIZE) {
+		queues[batch_count++ % thread_count].push(Batch(first, std::min(first + BATCH_SIZE, game_count)));
+	}
+
+	std::vector<Stats> results(thread_count, Stats(rules));
+	std::vector<std::thread> workers;
+	for(int worker = 0; worker < thread_count; ++worker) {
+		workers.push_back(std::thread([&, worker]() {
+			Batch batch;
+			while(true) {
+				bool found = queues[worker].pop(batch);
+				for(int i = 1; !found && i < thread_count; ++i) {
+					found = queues[(worker + i) % thread_count].steal(batch);
+				}
+				if(!found) {
+					break;
+				}
+				for(int game = batch.first; game < batch.last; ++game) {
+					play(Random(seed + game).next(), rules, bot, results[worker]);
+				}
+			}
+		}));
+	}
+	Stats total(rules);
+	for(int worker = 0; worker < thread_count; ++worker) {
+		workers[worker].join();
+		total.merge(results[worker]);
+	}
+	return total;
+}
+
+void report(std::ostream & out, uint64_t seed, const Rules & rules, const Stats & stats, double seconds)
+{
+	double games = std::max(1L, stats.games);
+	out << "seed=" << seed
+		<< " days=" << rules.days_left
+		<< " max_enemies=" << rules.max_enemy_count
+		<< " battle_money=" << rules.base_money_for_battle
+		<< " stat_cost=" << rules.stat_cost
+		<< " world_size=" << rules.world_size
+		<< " battle_size=" << rules.battle_size
+		<< " puzzle_size=" << rules.puzzle_size << '\n';
+	out << "  games: " << stats.games
+		<< " (" << int(stats.games / seconds) << " games/s, "
+		<< long(stats.steps / seconds) << " steps/s)\n";
+	out << "  won: " << 100.0 * stats.outcomes[GameState::WON] / games << "%"
+		<< "  died: " << 100.0 * stats.outcomes[GameState::DIED] / games << "%"
+		<< "  out of time: " << 100.0 * stats.outcomes[GameState::OUT_OF_TIME] / games << "%\n";
+	out << "  days used: " << stats.days_used / games << '\n';
+	out << "  money curve:";
+	for(int point = 0; point < MONEY_CURVE_POINTS; ++point) {
+		int day = point * rules.days_left / MONEY_CURVE_POINTS;
+		long samples = std::max(1L, stats.games_by_day[day]);
+		out << ' ' << day << ':' << stats.money_by_day[day] / samples;
+	}
+	out << '\n';
+	out << "  death causes:";
+	for(unsigned count = 1; count < stats.killed_by.size(); ++count) {
+		out << " group of " << count << ": " << stats.killed_by[count] << ',';
+	}
+	out << " time ran out: " << stats.outcomes[GameState::OUT_OF_TIME] << '\n';
+}
+
+// Every rules of the list with every value of the field.
+void vary(std::vector<Rules> & combinations, int Rules::* field, const std::vector<int> & values)
+{
+	std::vector<Rules> result;
+	for(const Rules & rules : combinations) {
+		for(int value : values) {
+			result.push_back(rules);
+			result.back().*field = value;
+		}
+	}
+	combinations.swap(result);
+}
+
+std::vector<int> parse_values(const std::string & arg)
+{
+	std::vector<int> values;
+	std::istringstream in(arg);
+	std::string value;
+	while(std::getline(in, value, ',')) {
+		values.push_back(atoi(value.c_str()));
+	}
+	return values;
+}
+
+int usage(const char * name)
+{
+	std::cerr << "Usage: " << name << " [-n GAMES] [-j THREADS] [--seed N] [--pieces N] [--win-chance PERCENT]"
+		" [--days N,...] [--max-enemies N,...] [--battle-money N,...] [--stat-cost N,...] [--world-size N,...]"
+		" [--battle-size N,...] [--puzzle-size N,...]\n"
+		"Every combination of comma-separated values is simulated.\n";
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	uint64_t seed = time(NULL);
+	int game_count = DEFAULT_GAME_COUNT;
+	int thread_count = std::max(1u, std::thread::hardware_concurrency());
+	int pieces_to_dig = PUZZLE_SIZE * PUZZLE_SIZE / 3;
+	int win_chance = 0;
+	std::vector<int> days(1, DAYS_LEFT), max_enemies(1, MAX_ENEMY_COUNT);
+	std::vector<int> battle_money(1, BASE_MONEY_FOR_BATTLE), stat_cost(1, STAT_COST);
+	std::vector<int> world_sizes(1, MAP_SIZE), battle_sizes(1, BATTLEFIELD_SIZE), puzzle_sizes(1, PUZZLE_SIZE);
+	bool max_enemies_given = false;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(i + 1 >= argc) {
+			return usage(argv[0]);
+		}
+		std::string value = argv[++i];
+		if(arg == "-n") {
+			game_count = atoi(value.c_str());
+		} else if(arg == "-j") {
+			thread_count = std::max(1, atoi(value.c_str()));
+		} else if(arg == "--seed") {
+			seed = strtoull(value.c_str(), nullptr, 10);
+		} else if(arg == "--pieces") {
+			pieces_to_dig = atoi(value.c_str());
+		} else if(arg == "--win-chance") {
+			win_chance = atoi(value.c_str());
+		} else if(arg == "--days") {
+			days = parse_values(value);
+		} else if(arg == "--max-enemies") {
+			max_enemies = parse_values(value);
+			max_enemies_given = true;
+		} else if(arg == "--battle-money") {
+			battle_money = parse_values(value);
+		} else if(arg == "--stat-cost") {
+			stat_cost = parse_values(value);
+		} else if(arg == "--world-size") {
+			world_sizes = parse_values(value);
+		} else if(arg == "--battle-size") {
+			battle_sizes = parse_values(value);
+		} else if(arg == "--puzzle-size") {
+			puzzle_sizes = parse_values(value);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	std::vector<Rules> combinations(1);
+	vary(combinations, &Rules::days_left, days);
+	vary(combinations, &Rules::max_enemy_count, max_enemies);
+	vary(combinations, &Rules::base_money_for_battle, battle_money);
+	vary(combinations, &Rules::stat_cost, stat_cost);
+	vary(combinations, &Rules::world_size, world_sizes);
+	vary(combinations, &Rules::battle_size, battle_sizes);
+	vary(combinations, &Rules::puzzle_size, puzzle_sizes);
+	for(Rules & rules : combinations) {
+		// The default group size is fitted to small battlefields as in the
+		// game, sizes asked for are checked as they are.
+		if(!max_enemies_given) {
+			rules.fit_enemy_count();
+		}
+		std::string error = rules.check();
+		if(!error.empty()) {
+			std::cerr << error << '\n';
+			return 1;
+		}
+	}
+
+	Bot bot(pieces_to_dig, win_chance / 100.0);
+	for(const Rules & rules : combinations) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Stats stats = simulate(seed, rules, bot, game_count, thread_count);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		report(std::cout, seed, rules, stats, std::max(elapsed.count(), 1e-9));
+	}
+	return 0;
+}
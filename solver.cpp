@@ -0,0 +1,302 @@
+#include "solver.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+enum {
+	MAX_SEARCH_DEPTH = 2000,
+	MIN_TABLE_BITS = 12,
+	// States a search adds to the table in a millisecond, with room to spare.
+	ENTRIES_PER_MS = 4000
+};
+
+static_assert(ENEMY_BASE_HP < 16, "Enemy HP should fit into four bits of the key.");
+
+// Cells take 6 bits, player HP 10 and enemy HP 4, which leaves room
+// for all enemies of the largest battlefield.
+uint64_t pack(const BattleState & state)
+{
+	uint64_t key = uint64_t(state.player) | (uint64_t(state.player_hp) << 6) | (uint64_t(state.enemy_count) << 16);
+	for(int i = 0; i < state.enemy_count; ++i) {
+		key |= (uint64_t(state.enemies[i]) | (uint64_t(state.enemy_hp[i]) << 6)) << (18 + i * 10);
+	}
+	return key;
+}
+
+uint64_t hash(uint64_t key)
+{
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+	return key ^ (key >> 31);
+}
+
+}
+
+BattleSolver::BattleSolver(int solver_max_table_bits)
+	: max_table_bits(solver_max_table_bits), entry_count(0), generation(0),
+	pass(0), depth(0), horizon(0), cycled(false), cut(false), strength(0), nodes(0), timed_out(false), duel_hp(0)
+{
+	std::fill(&damage_odds[0][0], &damage_odds[0][0] + sizeof(damage_odds) / sizeof(float), 0.0f);
+	damage_odds[0][0] = 1;
+	for(int count = 1; count <= BattleState::MAX_ENEMIES; ++count) {
+		for(int total = 0; total <= (count - 1) * (ENEMY_DAMAGE_RANGE - 1); ++total) {
+			for(int damage = 0; damage < ENEMY_DAMAGE_RANGE; ++damage) {
+				damage_odds[count][total + damage] += damage_odds[count - 1][total] / ENEMY_DAMAGE_RANGE;
+			}
+		}
+	}
+}
+
+Forecast BattleSolver::solve(const BattleState & battle, int battle_strength, int time_budget_ms, double precision)
+{
+	if(battle.enemy_count == 0) {
+		return Forecast(1, 0, 0, true);
+	}
+	deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(time_budget_ms);
+	reserve(time_budget_ms);
+	++generation;
+	entry_count = 0;
+	strength = battle_strength;
+	nodes = 0;
+	timed_out = false;
+
+	prepare_duels(battle.player_hp);
+
+	Forecast result;
+	for(pass = 1; !timed_out; ++pass) {
+		depth = 0;
+		horizon = std::min<int>(MAX_SEARCH_DEPTH, 2 << std::min(pass, 16));
+		cycled = false;
+		cut = false;
+		Value value = search(battle);
+		// A pass cut short by time mixes new and old values, so the last
+		// whole pass is kept instead, if there was one.
+		if(timed_out && pass > 1) {
+			break;
+		}
+		bool settled = !cut && (!cycled || std::abs(value.win - result.win) < precision);
+		result = Forecast(value.win, value.hp_loss, pass, settled && !timed_out);
+		if(settled) {
+			break;
+		}
+	}
+	return result;
+}
+
+void BattleSolver::reserve(int time_budget_ms)
+{
+	// The table is kept at most three quarters full.
+	size_t wanted = size_t(std::max(time_budget_ms, 1)) * ENTRIES_PER_MS / 3 * 4;
+	int bits = MIN_TABLE_BITS;
+	while(bits < max_table_bits && (size_t(1) << bits) < wanted) {
+		++bits;
+	}
+	if(table.size() < (size_t(1) << bits)) {
+		// Entries of the old size are dropped, they would be in the wrong slots.
+		table.assign(size_t(1) << bits, Entry());
+		generation = 0;
+	}
+}
+
+void BattleSolver::prepare_duels(int max_hp)
+{
+	duel_hp = max_hp;
+	int stride = duel_hp + 1;
+	duels.assign(size_t(stride) * (ENEMY_BASE_HP + 1) * stride, 0.0f);
+	std::vector<float> ending(stride);
+	for(int enemy_hp = 1; enemy_hp <= ENEMY_BASE_HP; ++enemy_hp) {
+		for(int hp = 1; hp <= duel_hp; ++hp) {
+			std::fill(ending.begin(), ending.end(), 0.0f);
+			float self_odds = 0;
+			for(int roll = 0; roll < PLAYER_DAMAGE_RANGE; ++roll) {
+				int enemy_left = enemy_hp - strength - roll;
+				if(enemy_left <= 0) {
+					ending[hp] += 1.0f / PLAYER_DAMAGE_RANGE;
+					continue;
+				}
+				for(int damage = 0; damage < ENEMY_DAMAGE_RANGE && damage < hp; ++damage) {
+					float odds = 1.0f / (PLAYER_DAMAGE_RANGE * ENEMY_DAMAGE_RANGE);
+					if(enemy_left == enemy_hp && damage == 0) {
+						self_odds += odds;
+						continue;
+					}
+					const float * next = duel(hp - damage, enemy_left);
+					for(int left = 1; left <= hp - damage; ++left) {
+						ending[left] += odds * next[left];
+					}
+				}
+			}
+			float * target = duel(hp, enemy_hp);
+			for(int left = 1; left <= hp; ++left) {
+				target[left] = ending[left] / (1 - self_odds);
+			}
+		}
+	}
+}
+
+BattleSolver::Value BattleSolver::estimate(const BattleState & state)
+{
+	std::vector<float> & hp_odds = estimate_odds, & next = estimate_next;
+	hp_odds.assign(duel_hp + 1, 0.0f);
+	hp_odds[state.player_hp] = 1;
+	for(int i = 0; i < state.enemy_count; ++i) {
+		next.assign(duel_hp + 1, 0.0f);
+		for(int hp = 1; hp <= state.player_hp; ++hp) {
+			if(hp_odds[hp] == 0) {
+				continue;
+			}
+			const float * ending = duel(hp, state.enemy_hp[i]);
+			for(int left = 1; left <= hp; ++left) {
+				next[left] += hp_odds[hp] * ending[left];
+			}
+		}
+		hp_odds.swap(next);
+	}
+	Value value(0, state.player_hp);
+	for(int hp = 1; hp <= state.player_hp; ++hp) {
+		value.win += hp_odds[hp];
+		value.hp_loss -= hp_odds[hp] * hp;
+	}
+	return value;
+}
+
+bool BattleSolver::out_of_time()
+{
+	if(!timed_out && (++nodes & 0xff) == 0) {
+		timed_out = std::chrono::steady_clock::now() > deadline;
+	}
+	return timed_out;
+}
+
+BattleSolver::Entry * BattleSolver::find(uint64_t key)
+{
+	size_t mask = table.size() - 1;
+	for(size_t index = hash(key) & mask; ; index = (index + 1) & mask) {
+		Entry & entry = table[index];
+		if(entry.generation != generation) {
+			if(entry_count >= table.size() / 4 * 3) {
+				timed_out = true;
+				return nullptr;
+			}
+			++entry_count;
+			entry = Entry();
+			entry.key = key;
+			entry.generation = generation;
+			return &entry;
+		}
+		if(entry.key == key) {
+			return &entry;
+		}
+	}
+}
+
+BattleSolver::Value BattleSolver::search(const BattleState & state)
+{
+	uint64_t key = pack(state);
+	Entry * entry = find(key);
+	if(!entry) {
+		return estimate(state);
+	}
+	if(entry->pass == pass || depth >= horizon || out_of_time()) {
+		cycled = cycled || entry->open || depth >= MAX_SEARCH_DEPTH;
+		cut = cut || (depth >= horizon && horizon < MAX_SEARCH_DEPTH);
+		if(!entry->valued) {
+			entry->value = estimate(state);
+			entry->valued = true;
+		}
+		return entry->value;
+	}
+	entry->pass = pass;
+	entry->open = true;
+	++depth;
+
+	// With a self loop of chance p a move is worth rest / (1 - p),
+	// and the best of those is the fixed point of the whole state.
+	Value best(-1, 0);
+	Board moves = state.moves();
+	while(moves) {
+		int cell = __builtin_ctzll(moves);
+		moves &= moves - 1;
+		Value value;
+		float self_odds = 0;
+		int enemy = state.enemy_at(cell);
+		if(enemy >= 0) {
+			for(int roll = 0; roll < PLAYER_DAMAGE_RANGE; ++roll) {
+				BattleState next = state;
+				next.hit_enemy(enemy, strength + roll);
+				float roll_self_odds = 0;
+				Value outcome = enemy_turn(next, key, roll_self_odds);
+				value.win += outcome.win / PLAYER_DAMAGE_RANGE;
+				value.hp_loss += outcome.hp_loss / PLAYER_DAMAGE_RANGE;
+				self_odds += roll_self_odds / PLAYER_DAMAGE_RANGE;
+			}
+		} else {
+			BattleState next = state;
+			next.player = cell;
+			value = enemy_turn(next, key, self_odds);
+		}
+		if(self_odds > 0) {
+			value.win /= 1 - self_odds;
+			value.hp_loss /= 1 - self_odds;
+		}
+		if(value.win > best.win + 1e-6 || (value.win > best.win - 1e-6 && value.hp_loss < best.hp_loss)) {
+			best = value;
+		}
+	}
+	if(best.win < 0) {
+		best = Value();
+	}
+
+	--depth;
+	entry->open = false;
+	entry->valued = true;
+	entry->value = best;
+	return best;
+}
+
+BattleSolver::Value BattleSolver::enemy_turn(BattleState state, uint64_t self, float & self_odds)
+{
+	if(state.enemy_count == 0) {
+		return Value(1, 0);
+	}
+	int attackers = state.move_enemies();
+	Value value;
+	int hp = state.player_hp;
+	for(int total = 0; total <= attackers * (ENEMY_DAMAGE_RANGE - 1); ++total) {
+		float odds = damage_odds[attackers][total];
+		if(total >= hp) {
+			value.hp_loss += odds * hp;
+			continue;
+		}
+		state.player_hp = hp - total;
+		if(pack(state) == self) {
+			self_odds += odds;
+			continue;
+		}
+		Value outcome = search(state);
+		value.win += odds * outcome.win;
+		value.hp_loss += odds * (outcome.hp_loss + total);
+	}
+	return value;
+}
+
+namespace {
+
+BattleSolver & thread_solver()
+{
+	static thread_local BattleSolver solver;
+	return solver;
+}
+
+}
+
+Forecast forecast_battle(const BattleState & battle, int strength, int time_budget_ms)
+{
+	return thread_solver().solve(battle, strength, time_budget_ms);
+}
+
+void prepare_forecasts(int time_budget_ms)
+{
+	thread_solver().reserve(time_budget_ms);
+}
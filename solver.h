@@ -0,0 +1,90 @@
+#pragma once
+#include "game.h"
+#include <vector>
+#include <chrono>
+
+struct Forecast {
+	double win;
+	double hp_loss;
+	int passes;
+	// False when time ran out before the passes stopped changing the answer,
+	// then win is an estimate that leans on the guess for unsolved states.
+	// Within the 10-100 ms that the UI and server allow, that is usual for
+	// two or more enemies on the default battlefield: an exact answer there
+	// takes seconds.
+	bool exact;
+	Forecast(double forecast_win = 0, double forecast_hp_loss = 0, int forecast_passes = 0, bool forecast_exact = false)
+		: win(forecast_win), hp_loss(forecast_hp_loss), passes(forecast_passes), exact(forecast_exact)
+	{}
+};
+
+// Expectimax over battle states: the player picks the move with the best
+// chance to win (then the least expected HP loss), damage rolls are averaged.
+// Every reachable state is memoized in a transposition table keyed by the
+// packed state. A turn that repeats the same state (nobody took damage) is
+// solved in closed form; longer cycles reuse the value from the previous
+// pass, and then passes repeat until the answer stops changing.
+// Passes look twice as many turns ahead as the one before, so a large
+// battle is searched wide before it is searched deep. States past the
+// horizon, and cycles met for the first time, are guessed as if the
+// enemies were fought one at a time, each to the death.
+class BattleSolver {
+public:
+	// The table grows with the time budget up to 1 << max_table_bits entries.
+	BattleSolver(int max_table_bits = 20);
+	// Grows the table to what a search of that budget can fill, so the
+	// first solve does not spend its budget on it.
+	void reserve(int time_budget_ms);
+	// Growing the table counts against the time budget.
+	Forecast solve(const BattleState & battle, int strength, int time_budget_ms = 50, double precision = 0.00001);
+private:
+	struct Value {
+		float win, hp_loss;
+		Value(float value_win = 0, float value_hp_loss = 0)
+			: win(value_win), hp_loss(value_hp_loss)
+		{}
+	};
+	struct Entry {
+		uint64_t key;
+		uint32_t generation;
+		int pass;
+		bool open;
+		// False until the value is either searched or guessed.
+		bool valued;
+		Value value;
+		Entry() : key(0), generation(0), pass(0), open(false), valued(false) {}
+	};
+
+	int max_table_bits;
+	std::vector<Entry> table;
+	unsigned entry_count;
+	uint32_t generation;
+	int pass;
+	int depth, horizon;
+	// Cycled is set when a pass met a state it was still searching, cut when
+	// it stopped at the horizon.
+	bool cycled, cut;
+	int strength;
+	long nodes;
+	bool timed_out;
+	std::chrono::steady_clock::time_point deadline;
+	// Chance of every total damage when that many enemies attack at once.
+	float damage_odds[BattleState::MAX_ENEMIES + 1][BattleState::MAX_ENEMIES * ENEMY_DAMAGE_RANGE];
+	// Chance to win a duel against one enemy and end with each HP, by player
+	// and enemy HP, for the current strength.
+	int duel_hp;
+	std::vector<float> duels;
+	std::vector<float> estimate_odds, estimate_next;
+
+	float * duel(int hp, int enemy_hp) { return &duels[(size_t(hp) * (ENEMY_BASE_HP + 1) + enemy_hp) * (duel_hp + 1)]; }
+	void prepare_duels(int max_hp);
+	Value estimate(const BattleState & state);
+	Entry * find(uint64_t key);
+	Value search(const BattleState & state);
+	Value enemy_turn(BattleState state, uint64_t self, float & self_odds);
+	bool out_of_time();
+};
+
+// Both use one solver per thread.
+Forecast forecast_battle(const BattleState & battle, int strength, int time_budget_ms = 50);
+void prepare_forecasts(int time_budget_ms);
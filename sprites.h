@@ -0,0 +1,97 @@
+#pragma once
+#include <ncurses.h>
+
+// Tiles of the travel view and the battlefield, each with a 9x5 sprite
+// and a single-character minisprite for the puzzle and the world map.
+enum Tile {
+	TILE_EMPTY,
+	TILE_GRASS,
+	TILE_FOREST,
+	TILE_PLAYER,
+	TILE_ENEMY,
+	TILE_TREASURE,
+	TILE_ARTIFACT,
+	TILE_COUNT
+};
+
+enum { SPRITE_WIDTH = 9, SPRITE_HEIGHT = 5 };
+
+struct SpriteRow {
+	chtype cells[SPRITE_WIDTH];
+};
+
+struct Sprite {
+	SpriteRow rows[SPRITE_HEIGHT];
+};
+
+struct SpriteAtlas {
+	Sprite tiles[TILE_COUNT];
+};
+
+constexpr chtype TILE_ATTRS[TILE_COUNT] = {
+	0,
+	COLOR_PAIR(1),
+	COLOR_PAIR(1) | A_BOLD,
+	COLOR_PAIR(2) | A_BOLD,
+	COLOR_PAIR(3) | A_BOLD,
+	COLOR_PAIR(4) | A_BOLD,
+	COLOR_PAIR(2) | A_BOLD,
+};
+
+constexpr chtype MINISPRITES[TILE_COUNT] = {
+	' ',
+	'"' | TILE_ATTRS[TILE_GRASS],
+	'#' | TILE_ATTRS[TILE_FOREST],
+	'@' | TILE_ATTRS[TILE_PLAYER],
+	'A' | TILE_ATTRS[TILE_ENEMY],
+	'*' | TILE_ATTRS[TILE_TREASURE],
+	'X' | TILE_ATTRS[TILE_ARTIFACT],
+};
+
+constexpr char SPRITE_TEXT[TILE_COUNT][SPRITE_HEIGHT][SPRITE_WIDTH + 1] = {
+	{ "         ", "         ", "         ", "         ", "         " },
+	{ "  '      ", " '    '  ", "  ' '    ", " '  '  ' ", "     ;   " },
+	{ "@@@@@@@@@", "@@@@@@@@@", "@@@@@@@@@", "@@@@@@@@@", " # # # # " },
+	{ "    @    ", "   / \\ | ", "  /|_|\\+ ", "   | |   ", "   L L   " },
+	{ "   38    ", "   ###   ", " 3/#3/   ", "   S S\\  ", "   S S ^ " },
+	{ " /=====\\ ", "/       \\", "+-------+", "|   9   |", "L_______J" },
+	{ "  \\   /  ", "   \\ /   ", "    X    ", "   / \\   ", "  /   \\  " },
+};
+
+// Compile-time unrolling of the text above into attributed rows.
+template<int... I> struct Indices {};
+template<int N, int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template<int... I> struct MakeIndices<0, I...> { typedef Indices<I...> Type; };
+
+template<int... X>
+constexpr SpriteRow make_sprite_row(const char (&text)[SPRITE_WIDTH + 1], chtype attrs, Indices<X...>)
+{
+	return SpriteRow{{ (chtype(text[X]) | attrs)... }};
+}
+
+template<int... Y>
+constexpr Sprite make_sprite(const char (&text)[SPRITE_HEIGHT][SPRITE_WIDTH + 1], chtype attrs, Indices<Y...>)
+{
+	return Sprite{{ make_sprite_row(text[Y], attrs, MakeIndices<SPRITE_WIDTH>::Type())... }};
+}
+
+template<int... T>
+constexpr SpriteAtlas make_sprite_atlas(Indices<T...>)
+{
+	return SpriteAtlas{{ make_sprite(SPRITE_TEXT[T], TILE_ATTRS[T], MakeIndices<SPRITE_HEIGHT>::Type())... }};
+}
+
+constexpr SpriteAtlas SPRITES = make_sprite_atlas(MakeIndices<TILE_COUNT>::Type());
+
+inline Tile tile_of(int sprite)
+{
+	switch(sprite) {
+		case '.': return TILE_GRASS;
+		case '#': return TILE_FOREST;
+		case '@': return TILE_PLAYER;
+		case 'A': return TILE_ENEMY;
+		case '*': return TILE_TREASURE;
+		case 'X': return TILE_ARTIFACT;
+		default: return TILE_EMPTY;
+	}
+}
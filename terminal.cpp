@@ -0,0 +1,296 @@
+#include "terminal.h"
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+
+enum {
+	DEFAULT_WIDTH = 80,
+	DEFAULT_HEIGHT = 24,
+	MAX_LINE_LENGTH = 4096,
+	// Cursor position, colours and one character.
+	MAX_CELL_OUTPUT = 32,
+	// Enough for most frames, bigger ones are sent in parts.
+	SESSION_OUTPUT_SIZE = 8192
+};
+
+void Terminal::print(int y, int x, const char * format, ...)
+{
+	char text[MAX_LINE_LENGTH];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	put_text(y, x, text);
+}
+
+
+CursesTerminal::CursesTerminal()
+{
+	initscr();
+	raw();
+	keypad(stdscr, TRUE);
+	noecho();
+	start_color();
+	curs_set(0);
+}
+
+CursesTerminal::~CursesTerminal()
+{
+	cbreak();
+	echo();
+	curs_set(1);
+	endwin();
+}
+
+void CursesTerminal::set_color_pair(int pair, int foreground, int background)
+{
+	init_pair(pair, foreground, background);
+}
+
+void CursesTerminal::clear_screen()
+{
+	erase();
+}
+
+void CursesTerminal::put(int y, int x, chtype ch)
+{
+	mvaddch(y, x, ch);
+}
+
+void CursesTerminal::put_row(int y, int x, const chtype * row, int count)
+{
+	mvaddchnstr(y, x, row, count);
+}
+
+void CursesTerminal::put_text(int y, int x, const char * text)
+{
+	mvaddstr(y, x, text);
+}
+
+int CursesTerminal::read_key()
+{
+	return getch();
+}
+
+void CursesTerminal::show()
+{
+	refresh();
+}
+
+int CursesTerminal::poll_key()
+{
+	nodelay(stdscr, TRUE);
+	int key = getch();
+	nodelay(stdscr, FALSE);
+	return key;
+}
+
+
+AnsiTerminal::AnsiTerminal()
+	: fd(STDOUT_FILENO), tty(true), width(DEFAULT_WIDTH), height(DEFAULT_HEIGHT)
+{
+	winsize size;
+	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+		width = size.ws_col;
+		height = size.ws_row;
+	}
+
+	tcgetattr(STDIN_FILENO, &saved_mode);
+	termios mode = saved_mode;
+	mode.c_iflag &= ~(IXON | ICRNL);
+	mode.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	mode.c_cc[VMIN] = 1;
+	mode.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &mode);
+	open_screen(width * height * MAX_CELL_OUTPUT);
+}
+
+AnsiTerminal::AnsiTerminal(int session_fd, int session_width, int session_height)
+	: fd(session_fd), tty(false), width(session_width), height(session_height)
+{
+	open_screen(SESSION_OUTPUT_SIZE);
+}
+
+AnsiTerminal::~AnsiTerminal()
+{
+	output_size = output_sent = 0;
+	append("\033[0m\033[2J\033[?25h\033[?1049l");
+	write_output();
+	if(tty) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_mode);
+	}
+}
+
+void AnsiTerminal::open_screen(unsigned output_capacity)
+{
+	output_size = output_sent = 0;
+	current_attrs = 0;
+	screen.assign(width * height, ' ');
+	shown.assign(width * height, ' ');
+	output.resize(output_capacity);
+	for(int pair = 0; pair < MAX_COLOR_PAIRS; ++pair) {
+		foregrounds[pair] = COLOR_WHITE;
+		backgrounds[pair] = COLOR_BLACK;
+	}
+	append("\033[?1049h\033[?25l\033[0m\033[2J");
+	write_output();
+}
+
+void AnsiTerminal::set_color_pair(int pair, int foreground, int background)
+{
+	if(pair > 0 && pair < MAX_COLOR_PAIRS) {
+		foregrounds[pair] = foreground;
+		backgrounds[pair] = background;
+	}
+}
+
+void AnsiTerminal::clear_screen()
+{
+	screen.assign(screen.size(), ' ');
+}
+
+void AnsiTerminal::put(int y, int x, chtype ch)
+{
+	if(x >= 0 && x < width && y >= 0 && y < height) {
+		screen[y * width + x] = ch;
+	}
+}
+
+void AnsiTerminal::put_row(int y, int x, const chtype * row, int count)
+{
+	for(int i = 0; i < count && row[i]; ++i) {
+		put(y, x + i, row[i]);
+	}
+}
+
+void AnsiTerminal::put_text(int y, int x, const char * text)
+{
+	for(; *text && y < height; ++text) {
+		if(*text == '\n') {
+			for(; x < width; ++x) {
+				put(y, x, ' ');
+			}
+		} else {
+			put(y, x++, (unsigned char)*text);
+		}
+		if(x >= width) {
+			x = 0;
+			++y;
+		}
+	}
+}
+
+int AnsiTerminal::read_key()
+{
+	flush();
+	unsigned char key;
+	if(read(tty ? STDIN_FILENO : fd, &key, 1) != 1) {
+		return ERR;
+	}
+	return key;
+}
+
+void AnsiTerminal::show()
+{
+	flush();
+}
+
+int AnsiTerminal::poll_key()
+{
+	pollfd input = { tty ? STDIN_FILENO : fd, POLLIN, 0 };
+	unsigned char key;
+	if(poll(&input, 1, 0) <= 0 || read(input.fd, &key, 1) != 1) {
+		return ERR;
+	}
+	return key;
+}
+
+void AnsiTerminal::append(const char * text)
+{
+	while(*text) {
+		output[output_size++] = *text++;
+	}
+}
+
+void AnsiTerminal::append_number(int number)
+{
+	char digits[12];
+	int count = 0;
+	do {
+		digits[count++] = '0' + number % 10;
+		number /= 10;
+	} while(number > 0);
+	while(count > 0) {
+		output[output_size++] = digits[--count];
+	}
+}
+
+void AnsiTerminal::flush()
+{
+	write_output();
+	while(!output_pending() && compose()) {
+		write_output();
+	}
+}
+
+bool AnsiTerminal::compose()
+{
+	int cursor = -1;
+	for(int i = 0; i < width * height; ++i) {
+		if(screen[i] == shown[i]) {
+			continue;
+		}
+		if(output_size + MAX_CELL_OUTPUT > output.size()) {
+			break;
+		}
+		shown[i] = screen[i];
+		if(i != cursor) {
+			append("\033[");
+			append_number(i / width + 1);
+			append(";");
+			append_number(i % width + 1);
+			append("H");
+		}
+		chtype attrs = screen[i] & (A_BOLD | A_COLOR);
+		if(attrs != current_attrs) {
+			append("\033[0");
+			if(attrs & A_BOLD) {
+				append(";1");
+			}
+			int pair = PAIR_NUMBER(attrs);
+			if(pair > 0 && pair < MAX_COLOR_PAIRS) {
+				append(";3");
+				append_number(foregrounds[pair]);
+				append(";4");
+				append_number(backgrounds[pair]);
+			}
+			append("m");
+			current_attrs = attrs;
+		}
+		output[output_size++] = char(screen[i] & A_CHARTEXT);
+		// The cursor stays at the last column after writing into it.
+		cursor = (i % width == width - 1) ? -1 : i + 1;
+	}
+	return output_size > 0;
+}
+
+void AnsiTerminal::write_output()
+{
+	while(output_sent < output_size) {
+		ssize_t result = write(fd, &output[output_sent], output_size - output_sent);
+		if(result < 0 && errno == EINTR) {
+			continue;
+		}
+		if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+		if(result <= 0) {
+			break;
+		}
+		output_sent += result;
+	}
+	output_size = output_sent = 0;
+}
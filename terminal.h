@@ -0,0 +1,78 @@
+#pragma once
+#include <ncurses.h>
+#include <termios.h>
+#include <vector>
+
+// Screen the game draws to. Cells are curses chtypes carrying their colour
+// pair and attributes. Nothing reaches the terminal until the next key is read.
+class Terminal {
+public:
+	virtual ~Terminal() {}
+	virtual void set_color_pair(int pair, int foreground, int background) = 0;
+	virtual void clear_screen() = 0;
+	virtual void put(int y, int x, chtype ch) = 0;
+	virtual void put_row(int y, int x, const chtype * row, int count) = 0;
+	// Like printw: text wraps at the right edge, newline clears the rest of the line.
+	virtual void put_text(int y, int x, const char * text) = 0;
+	virtual int read_key() = 0;
+	// Returns the next key if one is already queued, ERR otherwise.
+	virtual int poll_key() = 0;
+	// Sends the frame without waiting for a key.
+	virtual void show() = 0;
+	void print(int y, int x, const char * format, ...);
+};
+
+class CursesTerminal : public Terminal {
+public:
+	CursesTerminal();
+	virtual ~CursesTerminal();
+	virtual void set_color_pair(int pair, int foreground, int background);
+	virtual void clear_screen();
+	virtual void put(int y, int x, chtype ch);
+	virtual void put_row(int y, int x, const chtype * row, int count);
+	virtual void put_text(int y, int x, const char * text);
+	virtual int read_key();
+	virtual int poll_key();
+	virtual void show();
+};
+
+// Writes ANSI escape sequences directly. Each frame is composed in
+// a preallocated buffer from the cells that differ from the shown ones
+// and sent with a single write().
+// A session terminal talks to a non-blocking socket through a smaller
+// buffer: a frame that could not be sent at once is finished by later
+// flush() calls, and changes made meanwhile go out along with it.
+class AnsiTerminal : public Terminal {
+public:
+	AnsiTerminal();
+	AnsiTerminal(int session_fd, int session_width, int session_height);
+	virtual ~AnsiTerminal();
+	virtual void set_color_pair(int pair, int foreground, int background);
+	virtual void clear_screen();
+	virtual void put(int y, int x, chtype ch);
+	virtual void put_row(int y, int x, const chtype * row, int count);
+	virtual void put_text(int y, int x, const char * text);
+	virtual int read_key();
+	virtual int poll_key();
+	virtual void show();
+	void flush();
+	bool output_pending() const { return output_sent < output_size; }
+private:
+	enum { MAX_COLOR_PAIRS = 16 };
+
+	int fd;
+	bool tty;
+	int width, height;
+	std::vector<chtype> screen, shown;
+	std::vector<char> output;
+	unsigned output_size, output_sent;
+	chtype current_attrs;
+	short foregrounds[MAX_COLOR_PAIRS], backgrounds[MAX_COLOR_PAIRS];
+	termios saved_mode;
+
+	void open_screen(unsigned output_capacity);
+	bool compose();
+	void append(const char * text);
+	void append_number(int number);
+	void write_output();
+};
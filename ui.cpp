@@ -0,0 +1,532 @@
+#include "ui.h"
+#include <cstdio>
+
+const Chthon::Point BATTLE_MAP(0, 0);
+const Chthon::Point VIEW_MAP(0, 0);
+const Chthon::Point PUZZLE_CENTER(LEFT_STATUS_BAR + 6, 4);
+
+static_assert(int(FIGHTLOG_SIZE) <= int(FightLog::CAPACITY), "Every visible fight log line should be kept.");
+
+// What a key changes if it does anything worth saving: scrolling the map
+// or walking into forest leaves all of it as it was.
+struct Progress {
+	int mode, message, outcome, days_left, money, strength, endurance;
+	Chthon::Point player, battle_player;
+	unsigned battle_events;
+	int undo_levels;
+	Progress(const GameState & state, const UndoHistory & history)
+		: mode(state.mode), message(state.message), outcome(state.outcome),
+		days_left(state.days_left), money(state.money), strength(state.strength), endurance(state.endurance),
+		player(state.player), battle_player(state.battle.pos(state.battle.player)),
+		battle_events(state.battle.fightlog.count()), undo_levels(history.size())
+	{}
+	bool operator!=(const Progress & other) const
+	{
+		return mode != other.mode || message != other.message || outcome != other.outcome
+			|| days_left != other.days_left || money != other.money
+			|| strength != other.strength || endurance != other.endurance
+			|| player != other.player || battle_player != other.battle_player
+			|| battle_events != other.battle_events || undo_levels != other.undo_levels;
+	}
+};
+
+void draw_sprite(Terminal & term, const Chthon::Point & start, const Chthon::Point & pos, Tile tile)
+{
+	const Sprite & sprite = SPRITES.tiles[tile];
+	for(int y = 0; y < SPRITE_HEIGHT; ++y) {
+		term.put_row(
+				start.y + pos.y * SPRITE_HEIGHT + y,
+				start.x + pos.x * SPRITE_WIDTH,
+				sprite.rows[y].cells, SPRITE_WIDTH);
+	}
+}
+
+std::string check_screen(const Rules & rules)
+{
+	if(rules.battle_size > VIEW_SIZE) {
+		return "Battlefield size should be at most " + std::to_string(VIEW_SIZE) + " to fit on the screen.";
+	}
+	if(rules.sight_radius > MAX_VIEW_SIGHT) {
+		return "Sight should be at most " + std::to_string(MAX_VIEW_SIGHT) + " to fit on the screen.";
+	}
+	return std::string();
+}
+
+void draw_message(Terminal & term, GameState::Message message)
+{
+	switch(message) {
+		case GameState::ARTIFACT_FOUND:
+			term.print(11, 27, "+--------------------------+");
+			term.print(12, 27, "|You've found the artifact!|");
+			term.print(13, 27, "|      Good for you.       |");
+			term.print(14, 27, "| (press <space> to exit)  |");
+			term.print(15, 27, "+--------------------------+");
+			break;
+		case GameState::NO_ARTIFACT_HERE:
+			term.print(11, 27, "+--------------------------+");
+			term.print(12, 27, "|  Artifact is not here!   |");
+			term.print(13, 27, "| Precious time is wasted. |");
+			term.print(14, 27, "|      (press <space>)     |");
+			term.print(15, 27, "+--------------------------+");
+			break;
+		case GameState::PLAYER_DIED:
+			term.print(11, 27, "+--------------------------+");
+			term.print(12, 27, "|You were killed in battle.|");
+			term.print(13, 27, "|      Game is over.       |");
+			term.print(14, 27, "| (press <space> to exit)  |");
+			term.print(15, 27, "+--------------------------+");
+			break;
+		case GameState::TIME_RAN_OUT:
+			term.print(11, 27, "+---------------------------+");
+			term.print(12, 27, "|Time ran out and you didn't|");
+			term.print(13, 27, "|     find the artifact.    |");
+			term.print(14, 27, "|  (press <space> to exit)  |");
+			term.print(15, 27, "+---------------------------+");
+			break;
+		default: break;
+	}
+}
+
+void Game::draw()
+{
+	// Character screen is small and its message line comes and goes.
+	bool full = state.mode != drawn_mode || state.mode == GameState::CHARACTER_MODE;
+	if(full) {
+		term.clear_screen();
+		drawn_mode = state.mode;
+	}
+	if(state.mode != GameState::ENCOUNTER) {
+		forecast_ready = false;
+	}
+	switch(state.mode) {
+		case GameState::TRAVEL: draw_travel(full); break;
+		case GameState::ENCOUNTER:
+			draw_travel(full);
+			if(forecast_ready) {
+				break;
+			}
+			forecast = forecast_battle(state.battle, state.strength, forecast_time_ms);
+			forecast_ready = true;
+			term.print(11, 25, "+----------------------------+");
+			term.print(12, 25, "|    There are %d enemies     |", state.encountered());
+			// Larger battles are rarely solved within the input budget.
+			term.print(13, 25, "| %-12s%3d%%, ~%2d HP   |",
+					forecast.exact ? "Win chance" : "Win estimate", int(forecast.win * 100 + 0.5), int(forecast.hp_loss + 0.5));
+			term.print(14, 25, "| Do you want to fight them? |");
+			term.print(15, 25, "|           (y/n)            |");
+			term.print(16, 25, "+----------------------------+");
+			break;
+		case GameState::BATTLE: draw_fight(full); break;
+		case GameState::MAP_MODE:
+			if(full) {
+				draw_map();
+			}
+			break;
+		case GameState::CHARACTER_MODE: draw_character(); break;
+		case GameState::MESSAGE:
+			if(!full) {
+				break;
+			}
+			if(state.message == GameState::PLAYER_DIED) {
+				draw_fight(full);
+			} else {
+				draw_travel(full);
+			}
+			draw_message(term, state.message);
+			break;
+	}
+}
+
+void Game::draw_travel(bool full)
+{
+	if(full) {
+		for(int x = 0; x < statusbar.width(); ++x) {
+			for(int y = 0; y < statusbar.height(); ++y) {
+				term.put(y, LEFT_STATUS_BAR + x, statusbar.cell(x, y));
+			}
+		}
+	}
+	if(full || drawn_money != state.money) {
+		term.print(1, LEFT_STATUS_BAR + 14, "Money: %-10d", state.money);
+		drawn_money = state.money;
+	}
+	if(full || drawn_days != state.days_left) {
+		term.print(2, LEFT_STATUS_BAR + 14, "Days left: %-6d", state.days_left);
+		drawn_days = state.days_left;
+	}
+	int radius = std::min<int>(MAX_VIEW_SIGHT, std::max<int>(VIEW_RADIUS, state.fov.radius()));
+	int side = radius * 2 + 1;
+	if(drawn_view.width() != side) {
+		drawn_view = Chthon::Map<int>(side, side, 0);
+		full = true;
+	}
+	Chthon::Point mini_view((LEFT_STATUS_BAR - side) / 2, (SCREEN_HEIGHT - side) / 2);
+	for(int x = -radius; x <= radius; ++x) {
+		for(int y = -radius; y <= radius; ++y) {
+			Chthon::Point pos = state.player + Chthon::Point(x, y);
+			Chthon::Point view(x + radius, y + radius);
+			Tile tile = TILE_EMPTY;
+			if(x == 0 && y == 0) {
+				tile = TILE_PLAYER;
+			} else if(state.map.valid(pos) && state.fov.visible(pos)) {
+				tile = state.map.cell(pos).evil ? TILE_ENEMY : tile_of(state.map.cell(pos).sprite);
+			}
+			if(full || drawn_view.cell(view) != tile) {
+				if(radius == VIEW_RADIUS) {
+					draw_sprite(term, VIEW_MAP, view, tile);
+				} else {
+					term.put(mini_view.y + view.y, mini_view.x + view.x, MINISPRITES[tile]);
+				}
+				drawn_view.cell(view) = tile;
+			}
+		}
+	}
+
+	int puzzle_radius = state.rules.puzzle_size / 2;
+	for(int x = -puzzle_radius; x <= puzzle_radius; ++x) {
+		for(int y = -puzzle_radius; y <= puzzle_radius; ++y) {
+			Chthon::Point pos = state.artifact + Chthon::Point(x, y);
+			Chthon::Point piece(x + puzzle_radius, y + puzzle_radius);
+			Tile tile = TILE_EMPTY;
+			if(x == 0 && y == 0) {
+				tile = TILE_ARTIFACT;
+			} else if(state.map.valid(pos) && state.puzzle.cell(piece)) {
+				tile = tile_of(state.map.cell(pos).sprite);
+			}
+			if(full || drawn_puzzle.cell(piece) != tile) {
+				term.put(PUZZLE_CENTER.y + y, PUZZLE_CENTER.x + x, MINISPRITES[tile]);
+				drawn_puzzle.cell(piece) = tile;
+			}
+		}
+	}
+}
+
+void Game::draw_fight(bool full)
+{
+	const Battle & battle = state.battle;
+	if(full) {
+		for(int x = 0; x < fight_statusbar.width(); ++x) {
+			for(int y = 0; y < fight_statusbar.height(); ++y) {
+				term.put(y, LEFT_STATUS_BAR + x, fight_statusbar.cell(x, y));
+			}
+		}
+	}
+	// A battlefield smaller than the view leaves the rest of it empty.
+	for(int y = 0; y < VIEW_SIZE; ++y) {
+		for(int x = 0; x < VIEW_SIZE; ++x) {
+			Chthon::Point pos(x, y);
+			Tile tile = TILE_EMPTY;
+			if(battle.valid(pos)) {
+				int cell = battle.cell(pos);
+				tile = (battle.forest & Battle::bit(cell)) ? TILE_FOREST : TILE_GRASS;
+				if(cell == battle.player) {
+					tile = TILE_PLAYER;
+				} else if(battle.enemy_at(cell) >= 0) {
+					tile = TILE_ENEMY;
+				}
+			}
+			if(full || drawn_battlefield.cell(pos) != tile) {
+				draw_sprite(term, BATTLE_MAP, pos, tile);
+				drawn_battlefield.cell(pos) = tile;
+			}
+		}
+	}
+	if(full || drawn_hp != battle.player_hp) {
+		term.print(1, LEFT_STATUS_BAR + 1, "HP: %-5d", battle.player_hp);
+		drawn_hp = battle.player_hp;
+	}
+	int start_line = std::max(int(battle.fightlog.size()) - FIGHTLOG_SIZE, 0);
+	for(int line = 0; line < FIGHTLOG_SIZE; ++line) {
+		unsigned i = start_line + line;
+		FightEvent event = i < battle.fightlog.size() ? battle.fightlog[i] : FightEvent();
+		if(full || drawn_log[line] != event) {
+			char text[SCREEN_WIDTH - LEFT_STATUS_BAR];
+			event.format(text, sizeof(text));
+			term.print(3 + line, LEFT_STATUS_BAR + 1, "%-43s", text);
+			drawn_log[line] = event;
+		}
+	}
+}
+
+bool Game::scroll_map(int key)
+{
+	if(state.map.width() <= MAP_VIEW_WIDTH && state.map.height() <= SCREEN_HEIGHT) {
+		return false;
+	}
+	if(key == '+' && map_scale > 1) {
+		map_scale /= 2;
+		return true;
+	}
+	if(key == '-' && map_scale * std::min<int>(MAP_VIEW_WIDTH, MAP_VIEW_HEIGHT) < state.map.width()) {
+		map_scale *= 2;
+		return true;
+	}
+	Chthon::Point shift = get_shift(key);
+	if(shift.null()) {
+		return false;
+	}
+	map_center.x = std::max(0, std::min(state.map.width() - 1, map_center.x + shift.x * MAP_SCROLL_STEP * map_scale));
+	map_center.y = std::max(0, std::min(state.map.height() - 1, map_center.y + shift.y * MAP_SCROLL_STEP * map_scale));
+	return true;
+}
+
+// One character for a scale x scale block: treasure if any was seen there,
+// otherwise whatever covers most of the seen cells.
+Tile map_tile(const World & map, const Chthon::Point & corner, int scale)
+{
+	SeenCells seen = map.seen_cells(corner, scale, scale);
+	if(seen.treasure > 0) {
+		return TILE_TREASURE;
+	}
+	if(seen.forest + seen.grass == 0) {
+		return TILE_EMPTY;
+	}
+	return seen.forest > seen.grass ? TILE_FOREST : TILE_GRASS;
+}
+
+void Game::draw_map()
+{
+	if(state.map.width() <= MAP_VIEW_WIDTH && state.map.height() <= SCREEN_HEIGHT) {
+		int shift = (MAP_VIEW_WIDTH - state.map.width()) / 2;
+		for(int x = 0; x < state.map.width(); ++x) {
+			for(int y = 0; y < state.map.height(); ++y) {
+				if(state.map.cell(x, y).seen) {
+					term.put(y, shift + x, MINISPRITES[tile_of(state.map.cell(x, y).sprite)]);
+				}
+			}
+		}
+		term.put(state.player.y, shift + state.player.x, MINISPRITES[TILE_PLAYER]);
+		return;
+	}
+	Chthon::Point origin(map_center.x - MAP_VIEW_WIDTH / 2 * map_scale, map_center.y - MAP_VIEW_HEIGHT / 2 * map_scale);
+	for(int y = 0; y < MAP_VIEW_HEIGHT; ++y) {
+		for(int x = 0; x < MAP_VIEW_WIDTH; ++x) {
+			Chthon::Point corner(origin.x + x * map_scale, origin.y + y * map_scale);
+			Tile tile = map_tile(state.map, corner, map_scale);
+			if(tile != TILE_EMPTY) {
+				term.put(y, x, MINISPRITES[tile]);
+			}
+		}
+	}
+	Chthon::Point player_cell(state.player.x - origin.x, state.player.y - origin.y);
+	if(player_cell.x >= 0 && player_cell.y >= 0) {
+		player_cell = Chthon::Point(player_cell.x / map_scale, player_cell.y / map_scale);
+		if(player_cell.x < MAP_VIEW_WIDTH && player_cell.y < MAP_VIEW_HEIGHT) {
+			term.put(player_cell.y, player_cell.x, MINISPRITES[TILE_PLAYER]);
+		}
+	}
+	term.print(MAP_VIEW_HEIGHT, 0, "(%d, %d) 1:%d  (hjklyubn) Scroll  (+/-) Zoom  (m) Back",
+			map_center.x, map_center.y, map_scale);
+}
+
+void Game::draw_character()
+{
+	term.print(0, 0, "Money: %d      ", state.money);
+	term.print(1, 0, "Strength: %d (%d to increase)", state.strength, state.strength_cost());
+	term.print(2, 0, "Endurance: %d (%d to increase)", state.endurance, state.endurance_cost());
+	term.print(3, 0, "Increase strength (a), increase endurance (b) or exit (space)");
+	if(state.message == GameState::NOT_ENOUGH_FOR_STRENGTH) {
+		term.print(4, 0, "Not enough money to increase strength! ");
+	} else if(state.message == GameState::NOT_ENOUGH_FOR_ENDURANCE) {
+		term.print(4, 0, "Not enough money to increase endurance!");
+	}
+}
+
+Game::Game(uint64_t seed, Terminal & game_term, int game_forecast_time_ms, const Rules & rules)
+	: term(game_term), journal(nullptr), log(nullptr), unsaved(false), forecast_time_ms(game_forecast_time_ms), started(false), state(seed, rules), forecast_ready(false),
+	map_scale(1), drawn_mode(-1),
+	drawn_money(0), drawn_days(0), drawn_hp(0),
+	drawn_view(VIEW_SIZE, VIEW_SIZE, 0), drawn_puzzle(MAX_PUZZLE_SIZE, MAX_PUZZLE_SIZE, 0),
+	drawn_battlefield(VIEW_SIZE, VIEW_SIZE, 0), drawn_log(FIGHTLOG_SIZE)
+{
+	// The solver table is allocated here rather than in the first forecast.
+	prepare_forecasts(forecast_time_ms);
+	term.set_color_pair(1, COLOR_GREEN, COLOR_BLACK);
+	term.set_color_pair(2, COLOR_WHITE, COLOR_BLACK);
+	term.set_color_pair(3, COLOR_RED, COLOR_BLACK);
+	term.set_color_pair(4, COLOR_YELLOW, COLOR_BLACK);
+
+	const std::string statusbar_data = 
+		"+===========+===============================+"
+		"|Puzzle map |                               |"
+		"|           |                               |"
+		"|           |                               |"
+		"|           |                               |"
+		"|           |                               |"
+		"|           |                               |"
+		"+===========+===============================+"
+		"| (hjklyubn) Move                           |"
+		"| (m) Show map                              |"
+		"| (c) Character screen                      |"
+		"| (d) Dig for artifact (for 7 days)         |"
+		"| (z) Undo last turn                        |"
+		"|                                           |"
+		"| Walk onto enemy to fight with them.       |"
+		"| Walk onto treasure to collect it.         |"
+		"| Be careful not to fight with forces       |"
+		"| greater than you can handle.              |"
+		"| But do not waste any time! It's running   |"
+		"| out.                                      |"
+		"| Check map often. Once you're sure about   |"
+		"| artifact location, go there and dig.      |"
+		"| Don't forget to spend money on your       |"
+		"| character stats! It could reaaly help.    |"
+		"+===========================================+"
+		;
+	statusbar = Chthon::Map<int>(45, 25, statusbar_data.begin(), statusbar_data.end());
+
+	const std::string fight_statusbar_data = 
+		"+===========================================+"
+		"|                                           |"
+		"+===========================================+"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"|                                           |"
+		"+===========================================+"
+		"|                                           |"
+		"| (hjklyubn) Move                           |"
+		"| (q) Surrender and quit the game           |"
+		"|                                           |"
+		"| Walk onto enemy to fight with them.       |"
+		"| Use natural obstacles to fight enemies    |"
+		"| one by one.                               |"
+		"|                                           |"
+		"+===========================================+"
+		;
+	fight_statusbar = Chthon::Map<int>(45, 25, fight_statusbar_data.begin(), fight_statusbar_data.end());
+}
+
+void Game::start()
+{
+	const char * startup_screen =
+		"           ___________________________________________________________          \n"
+		"          /                                                        /_ \\         \n"
+		"          |                                                        |/ |         \n"
+		"          |     After a long, wasteful bloodshed that Evil brought |\\_/         \n"
+		"          | upon  peaceful eastern province,  it was defeated  and |            \n"
+		"          | discarded back  to the Empty Lands,  where it belongs. |            \n"
+		"          | No one  is dare  to  go  to  the  Empty Lands  without |            \n"
+		"          | legions  on their side.  But when  Evil  had  attacked |            \n"
+		"          | castle, it stole precious artifact, that was stored in |            \n"
+		"          | the abbey.  Lasandra's  Prism,  an  old  relic,  which |            \n"
+		"          | contains the soul of a saint.  It is an artifact, most |            \n"
+		"          | feared  by  the  Evil.  It  should  not be left in the |            \n"
+		"          | middle of the Empty Lands.  Your mission is to recover |            \n"
+		"          | that artifact.  And  stay alive,  of course.  No  more |            \n"
+		"          | man's blood should be spilled.  You must go there,  to |            \n"
+		"          | that strange and horrible land.                        |            \n"
+		"          |                                                        |            \n"
+		"          |                Where the Evil dwells.                  |            \n"
+		"          |                                                        |            \n"
+		"          |                                                        |            \n"
+		"          |                                                        |            \n"
+		"        __|_______________________________________________________ |            \n"
+		"       /                                                        / \\|            \n"
+		"       |                                                        |_/|            \n"
+		"       \\________________________________________________________\\__/            \n"
+		;
+	term.put_text(0, 0, startup_screen);
+}
+
+bool Game::handle_key(int key)
+{
+	if(started) {
+		if(journal) {
+			journal->record(key);
+		}
+		bool was_map_mode = state.mode == GameState::MAP_MODE;
+		// Quitting keeps the last save, so the game resumes from there;
+		// keys before it in the same frame are saved first.
+		if(key == 'q' && state.mode == GameState::TRAVEL) {
+			save();
+		}
+		Progress before(state, history);
+		history.step(state, key);
+		if(state.outcome == GameState::QUIT) {
+			unsaved = false;
+		} else if(!save_file.empty() && state.done()) {
+			remove(save_file.c_str());
+			unsaved = false;
+		} else if(Progress(state, history) != before) {
+			unsaved = true;
+		}
+		if(state.mode == GameState::MAP_MODE) {
+			if(!was_map_mode) {
+				map_center = state.player;
+				map_scale = 1;
+			} else if(scroll_map(key)) {
+				invalidate();
+			}
+		}
+	}
+	started = true;
+	return !state.done();
+}
+
+void Game::save()
+{
+	if(unsaved && !save_file.empty()) {
+		save_game(state, save_file);
+	}
+	unsaved = false;
+	if(journal) {
+		journal->flush();
+	}
+}
+
+bool Game::resume(const std::string & filename)
+{
+	GameState loaded = state;
+	if(!load_game(loaded, filename) || !check_screen(loaded.rules).empty()) {
+		return false;
+	}
+	state = loaded;
+	history.clear();
+	started = true;
+	invalidate();
+	return true;
+}
+
+bool Game::prompting() const
+{
+	return state.mode == GameState::ENCOUNTER || state.mode == GameState::MESSAGE;
+}
+
+int Game::run()
+{
+	if(started) {
+		draw();
+	} else {
+		start();
+	}
+	while(true) {
+		// Typeahead goes through the rules first, only the result is painted.
+		int key = term.read_key();
+		// Input is gone, the last frame is saved already.
+		if(key == ERR) {
+			return 0;
+		}
+		FrameProbe frame;
+		do {
+			if(!handle_key(key)) {
+				return 0;
+			}
+		} while(!prompting() && (key = term.poll_key()) != ERR);
+		save();
+		frame.lap(PROBE_RULES);
+		draw();
+		frame.lap(PROBE_DRAW);
+		term.show();
+		frame.lap(PROBE_OUTPUT);
+		frame.finish(log);
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "game.h"
+#include "solver.h"
+#include "sprites.h"
+#include "terminal.h"
+#include "journal.h"
+#include "save.h"
+#include "probe.h"
+
+enum {
+	LEFT_STATUS_BAR = VIEW_SIZE * SPRITE_WIDTH,
+	SCREEN_WIDTH = LEFT_STATUS_BAR + 45,
+	SCREEN_HEIGHT = 25,
+	FIGHTLOG_SIZE = 10,
+	MAP_VIEW_WIDTH = 80,
+	MAP_VIEW_HEIGHT = SCREEN_HEIGHT - 1,
+	MAP_SCROLL_STEP = 8,
+	// Sight beyond VIEW_RADIUS is shown a character a cell, as far as the
+	// screen is high.
+	MAX_VIEW_SIGHT = (SCREEN_HEIGHT - 1) / 2,
+	FORECAST_TIME_MS = 100
+};
+
+void draw_sprite(Terminal & term, const Chthon::Point & start, const Chthon::Point & pos, Tile tile);
+// Empty if the battlefield and the sight of these rules fit on the
+// screen, otherwise what does not.
+std::string check_screen(const Rules & rules);
+
+class Game {
+public:
+	Game(uint64_t seed, Terminal & game_term, int game_forecast_time_ms = FORECAST_TIME_MS, const Rules & rules = Rules());
+	// Shows the startup screen, the game begins with the next key.
+	void start();
+	// Every key applied to the game is recorded there from now on.
+	void set_journal(JournalWriter * game_journal) { journal = game_journal; }
+	// Picks up the game saved there, returns false if there is none or its
+	// rules do not fit on the screen.
+	bool resume(const std::string & filename);
+	// The game is saved there after every frame of keys, and the save is
+	// removed when the game is won or lost.
+	void set_save_file(const std::string & filename) { save_file = filename; }
+	// Writes the save if keys were applied since the last one, and flushes
+	// the journal. Called once a frame.
+	void save();
+	// Frame timings go there while probes are on.
+	void set_log(AsyncLog * game_log) { log = game_log; }
+	// Applies one key without repainting. Returns false when the game is over.
+	bool handle_key(int key);
+	// Queued keys should not be applied past a prompt before it is shown.
+	bool prompting() const;
+	void draw();
+	// Makes the next draw() repaint the whole screen.
+	void invalidate() { drawn_mode = -1; }
+	int run();
+private:
+	Terminal & term;
+	JournalWriter * journal;
+	AsyncLog * log;
+	std::string save_file;
+	bool unsaved;
+	int forecast_time_ms;
+	bool started;
+	GameState state;
+	UndoHistory history;
+	Forecast forecast;
+	bool forecast_ready;
+	Chthon::Map<int> statusbar, fight_statusbar;
+	// Worlds larger than the screen are shown around map_center,
+	// one character for map_scale x map_scale cells.
+	Chthon::Point map_center;
+	int map_scale;
+	// What is on the screen now, so a frame repaints only what has changed.
+	// Any mode switch clears the screen and repaints everything.
+	int drawn_mode;
+	int drawn_money, drawn_days, drawn_hp;
+	Chthon::Map<int> drawn_view, drawn_puzzle, drawn_battlefield;
+	std::vector<FightEvent> drawn_log;
+
+	void draw_travel(bool full);
+	void draw_fight(bool full);
+	bool scroll_map(int key);
+	void draw_map();
+	void draw_character();
+};
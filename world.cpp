@@ -0,0 +1,408 @@
+#include "world.h"
+#include <algorithm>
+
+Chthon::Point random_pos(Random & random, int width, int height)
+{
+	int x = random.range(width);
+	int y = random.range(height);
+	return Chthon::Point(x, y);
+}
+
+FreeCells::FreeCells(int free_width, int free_height)
+	: width(free_width), set(std::make_shared<Set>())
+{
+	set->cells.resize(free_width * free_height);
+	set->slots.resize(free_width * free_height);
+	for(unsigned i = 0; i < set->cells.size(); ++i) {
+		set->cells[i] = i;
+		set->slots[i] = i;
+	}
+}
+
+void FreeCells::remove(const Chthon::Point & pos)
+{
+	if(!contains(pos)) {
+		return;
+	}
+	Set & free = unshare(set);
+	int slot = free.slots[index(pos)];
+	free.slots[index(pos)] = -1;
+	if(slot != int(free.cells.size()) - 1) {
+		free.cells[slot] = free.cells.back();
+		free.slots[free.cells[slot]] = slot;
+	}
+	free.cells.pop_back();
+}
+
+void FreeCells::restore(const std::vector<int> & free_cells)
+{
+	Set & free = unshare(set);
+	free.cells = free_cells;
+	std::fill(free.slots.begin(), free.slots.end(), -1);
+	for(unsigned i = 0; i < free.cells.size(); ++i) {
+		free.slots[free.cells[i]] = i;
+	}
+}
+
+Chthon::Point FreeCells::sample(Random & random) const
+{
+	return pos(set->cells[random.range(set->cells.size())]);
+}
+
+Chthon::Point FreeCells::take(Random & random)
+{
+	Chthon::Point result = sample(random);
+	remove(result);
+	return result;
+}
+
+World::World()
+	: seed(0), size(0), chunks_per_row(0), max_enemy_count(1), clock(0), last_slot(-1),
+	changes(std::make_shared<ChangeShards>()), saved_indices(nullptr), saved_chunks(nullptr), saved_count(0)
+{
+}
+
+World::World(uint64_t world_seed, int world_size, int world_max_enemy_count,
+		const Chthon::Point & world_start, const Chthon::Point & world_artifact)
+	: seed(world_seed), size(world_size), chunks_per_row((world_size + CHUNK_SIZE - 1) / CHUNK_SIZE),
+	max_enemy_count(world_max_enemy_count), start(world_start), artifact(world_artifact),
+	clock(0), last_slot(-1), changes(std::make_shared<ChangeShards>()),
+	saved_indices(nullptr), saved_chunks(nullptr), saved_count(0)
+{
+	resident.reserve(MAX_RESIDENT_CHUNKS);
+	resident_index.reserve(MAX_RESIDENT_CHUNKS);
+	resident_used.reserve(MAX_RESIDENT_CHUNKS);
+}
+
+std::vector<Chthon::Point> World::explored_chunks() const
+{
+	std::vector<int> indices(saved_indices, saved_indices + saved_count);
+	for(const std::shared_ptr<ChangeMap> & shard : *changes) {
+		if(!shard) {
+			continue;
+		}
+		for(const ChangeMap::value_type & chunk_changes : *shard) {
+			if(!saved(chunk_changes.first)) {
+				indices.push_back(chunk_changes.first);
+			}
+		}
+	}
+	std::sort(indices.begin(), indices.end());
+	std::vector<Chthon::Point> result;
+	for(int index : indices) {
+		result.push_back(Chthon::Point(index % chunks_per_row * CHUNK_SIZE, index / chunks_per_row * CHUNK_SIZE));
+	}
+	return result;
+}
+
+static uint64_t low_bits(int count)
+{
+	return count >= 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+}
+
+uint64_t World::row(int plane, const Chthon::Point & row_start, int count, bool outside) const
+{
+	uint64_t result = 0;
+	for(int shift = 0; shift < count; ) {
+		Chthon::Point pos(row_start.x + shift, row_start.y);
+		int span = count - shift;
+		if(!valid(pos)) {
+			if(pos.x < 0 && pos.y >= 0 && pos.y < size) {
+				span = std::min(span, -pos.x);
+			}
+			result |= outside ? low_bits(span) << shift : 0;
+		} else {
+			span = std::min(span, std::min(CHUNK_SIZE - (pos.x & (CHUNK_SIZE - 1)), size - pos.x));
+			uint64_t bits = chunk(chunk_index(pos)).row(plane, pos.y & (CHUNK_SIZE - 1)) >> (pos.x & (CHUNK_SIZE - 1));
+			result |= (bits & low_bits(span)) << shift;
+		}
+		shift += span;
+	}
+	return result;
+}
+
+SeenCells World::seen_cells(const Chthon::Point & corner, int area_width, int area_height) const
+{
+	SeenCells result;
+	int x_end = std::min(corner.x + area_width, size);
+	int y_end = std::min(corner.y + area_height, size);
+	for(int y0 = std::max(corner.y, 0); y0 < y_end; y0 = (y0 / CHUNK_SIZE + 1) * CHUNK_SIZE) {
+		for(int x0 = std::max(corner.x, 0); x0 < x_end; x0 = (x0 / CHUNK_SIZE + 1) * CHUNK_SIZE) {
+			Chthon::Point pos(x0, y0);
+			if(!explored(pos)) {
+				continue;
+			}
+			const Chunk & source = chunk(chunk_index(pos));
+			int y1 = std::min(y_end, (y0 / CHUNK_SIZE + 1) * CHUNK_SIZE);
+			int x1 = std::min(x_end, (x0 / CHUNK_SIZE + 1) * CHUNK_SIZE);
+			uint32_t columns = uint32_t(low_bits(x1 - x0) << (x0 & (CHUNK_SIZE - 1)));
+			for(int y = y0; y < y1; ++y) {
+				int row = y & (CHUNK_SIZE - 1);
+				uint32_t seen = source.row(PLANE_SEEN, row) & columns;
+				uint32_t forest = source.row(PLANE_FOREST, row);
+				result.forest += __builtin_popcount(seen & forest);
+				result.grass += __builtin_popcount(seen & ~forest);
+				result.treasure += __builtin_popcount(seen & source.row(PLANE_TREASURE, row));
+			}
+		}
+	}
+	return result;
+}
+
+void World::see(const Chthon::Point & pos)
+{
+	if(cell(pos).seen) {
+		return;
+	}
+	own_chunk(chunk_index(pos)).set(PLANE_SEEN, cell_index(pos), true);
+	own_changes(chunk_index(pos)).set(CHANGE_SEEN, cell_index(pos), true);
+}
+
+void World::clear(const Chthon::Point & pos)
+{
+	int offset = cell_index(pos);
+	Changes & chunk_changes = own_changes(chunk_index(pos));
+	chunk_changes.set(CHANGE_CLEARED, offset, true);
+	chunk_changes.set(CHANGE_MOVED, offset, false);
+	Chunk & target = own_chunk(chunk_index(pos));
+	for(int plane : { PLANE_FOREST, PLANE_TREASURE, PLANE_EVIL_LOW, PLANE_EVIL_HIGH }) {
+		target.set(plane, offset, false);
+	}
+}
+
+void World::set_evil(const Chthon::Point & pos, int count)
+{
+	Changes & chunk_changes = own_changes(chunk_index(pos));
+	int offset = cell_index(pos);
+	chunk_changes.set(CHANGE_MOVED, offset, true);
+	chunk_changes.set(CHANGE_EVIL_LOW, offset, count & 1);
+	chunk_changes.set(CHANGE_EVIL_HIGH, offset, count & 2);
+	Chunk & target = own_chunk(chunk_index(pos));
+	target.set(PLANE_EVIL_LOW, offset, count & 1);
+	target.set(PLANE_EVIL_HIGH, offset, count & 2);
+}
+
+void World::save(std::ostream & out) const
+{
+	std::vector<Chthon::Point> chunks = explored_chunks();
+	SavedWorld header = SavedWorld();
+	header.seed = seed;
+	header.size = size;
+	header.max_enemy_count = max_enemy_count;
+	header.start_x = start.x;
+	header.start_y = start.y;
+	header.artifact_x = artifact.x;
+	header.artifact_y = artifact.y;
+	header.chunk_count = chunks.size();
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	for(const Chthon::Point & origin : chunks) {
+		int32_t index = chunk_index(origin);
+		out.write(reinterpret_cast<const char *>(&index), sizeof(index));
+	}
+	if(chunks.size() % 2) {
+		int32_t padding = 0;
+		out.write(reinterpret_cast<const char *>(&padding), sizeof(padding));
+	}
+	// Chunks that are not resident are put together aside, so saving does
+	// not evict the ones around the player.
+	Chunk aside;
+	for(const Chthon::Point & origin : chunks) {
+		int index = chunk_index(origin);
+		std::vector<int>::const_iterator found = std::find(resident_index.begin(), resident_index.end(), index);
+		const Chunk * source = &aside;
+		if(found != resident_index.end()) {
+			source = resident[found - resident_index.begin()].get();
+		} else {
+			generate(index, aside);
+		}
+		out.write(reinterpret_cast<const char *>(source), sizeof(*source));
+	}
+}
+
+bool World::read_saved(const char * data, size_t data_size, SavedWorld & header)
+{
+	if(data_size < sizeof(header)) {
+		return false;
+	}
+	std::copy(data, data + sizeof(header), reinterpret_cast<char *>(&header));
+	size_t table_size = (header.chunk_count + header.chunk_count % 2) * sizeof(int32_t);
+	if(header.chunk_count < 0 || header.size <= 0 || header.size > MAX_WORLD_SIZE
+		|| header.max_enemy_count < 1 || header.max_enemy_count > MAX_EVIL_GROUP
+		|| data_size < sizeof(header) + table_size + header.chunk_count * sizeof(Chunk)) {
+		return false;
+	}
+	// Chunks are looked up by binary search over the indices.
+	int64_t chunks_per_row = (header.size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	const int32_t * indices = reinterpret_cast<const int32_t *>(data + sizeof(header));
+	int64_t previous = -1;
+	for(int i = 0; i < header.chunk_count; ++i) {
+		if(indices[i] <= previous || indices[i] >= chunks_per_row * chunks_per_row) {
+			return false;
+		}
+		previous = indices[i];
+	}
+	return true;
+}
+
+void World::use_saved(const char * data, const SavedWorld & header, const std::shared_ptr<const void> & storage)
+{
+	size_t table_size = (header.chunk_count + header.chunk_count % 2) * sizeof(int32_t);
+	saved_storage = storage;
+	saved_indices = reinterpret_cast<const int32_t *>(data + sizeof(header));
+	saved_chunks = reinterpret_cast<const Chunk *>(data + sizeof(header) + table_size);
+	saved_count = header.chunk_count;
+}
+
+bool World::load(const char * data, size_t data_size, const std::shared_ptr<const void> & storage)
+{
+	SavedWorld header;
+	if(!read_saved(data, data_size, header)) {
+		return false;
+	}
+	*this = World(header.seed, header.size, header.max_enemy_count,
+			Chthon::Point(header.start_x, header.start_y), Chthon::Point(header.artifact_x, header.artifact_y));
+	use_saved(data, header, storage);
+	return true;
+}
+
+bool World::reload(const char * data, size_t data_size, const std::shared_ptr<const void> & storage)
+{
+	SavedWorld header;
+	if(!read_saved(data, data_size, header) || header.seed != seed || header.size != size) {
+		return false;
+	}
+	use_saved(data, header, storage);
+	changes = std::make_shared<ChangeShards>();
+	return true;
+}
+
+const World::Chunk * World::saved(int index) const
+{
+	const int32_t * found = std::lower_bound(saved_indices, saved_indices + saved_count, index);
+	if(found == saved_indices + saved_count || *found != index) {
+		return nullptr;
+	}
+	return saved_chunks + (found - saved_indices);
+}
+
+const World::Chunk & World::chunk(int index) const
+{
+	if(last_slot >= 0) {
+		// The last chunk is not stamped on every read, only when left.
+		resident_used[last_slot] = ++clock;
+		if(resident_index[last_slot] == index) {
+			return *resident[last_slot];
+		}
+	}
+	std::vector<int>::const_iterator found = std::find(resident_index.begin(), resident_index.end(), index);
+	int slot = found - resident_index.begin();
+	if(found == resident_index.end()) {
+		if(resident.size() < MAX_RESIDENT_CHUNKS) {
+			slot = resident.size();
+			resident.push_back(std::make_shared<Chunk>());
+			resident_index.push_back(index);
+			resident_used.push_back(0);
+		} else {
+			slot = std::min_element(resident_used.begin(), resident_used.end()) - resident_used.begin();
+			resident_index[slot] = index;
+			if(!resident[slot].unique()) {
+				resident[slot] = std::make_shared<Chunk>();
+			}
+		}
+		generate(index, *resident[slot]);
+	}
+	last_slot = slot;
+	resident_used[slot] = ++clock;
+	return *resident[slot];
+}
+
+World::Chunk & World::own_chunk(int index)
+{
+	chunk(index);
+	if(!resident[last_slot].unique()) {
+		resident[last_slot] = std::make_shared<Chunk>(*resident[last_slot]);
+	}
+	return *resident[last_slot];
+}
+
+World::Changes & World::own_changes(int index)
+{
+	std::shared_ptr<ChangeMap> & shard = unshare(changes)[index % CHANGE_SHARDS];
+	if(!shard) {
+		shard = std::make_shared<ChangeMap>();
+	}
+	std::shared_ptr<Changes> & chunk_changes = unshare(shard)[index];
+	if(!chunk_changes) {
+		chunk_changes = std::make_shared<Changes>();
+	}
+	return unshare(chunk_changes);
+}
+
+const World::Changes * World::find_changes(int index) const
+{
+	const std::shared_ptr<ChangeMap> & shard = (*changes)[index % CHANGE_SHARDS];
+	if(!shard) {
+		return nullptr;
+	}
+	ChangeMap::const_iterator found = shard->find(index);
+	return found == shard->end() ? nullptr : found->second.get();
+}
+
+void World::generate(int index, Chunk & chunk) const
+{
+	Chthon::Point origin(index % chunks_per_row * CHUNK_SIZE, index / chunks_per_row * CHUNK_SIZE);
+	int width = std::min(int(CHUNK_SIZE), size - origin.x);
+	int height = std::min(int(CHUNK_SIZE), size - origin.y);
+	int area = width * height;
+	const Chunk * saved_chunk = saved(index);
+	if(saved_chunk) {
+		chunk = *saved_chunk;
+		apply_changes(index, chunk);
+		return;
+	}
+	Random random = Random(seed + uint64_t(index) * 0x9e3779b97f4a7c15ULL).split();
+
+	chunk = Chunk();
+	FreeCells free_cells(width, height);
+	for(int i = 0; i < area * 2 / 5; ++i) {
+		Chthon::Point pos = random_pos(random, width, height);
+		chunk.set(PLANE_FOREST, cell_index(pos), true);
+		free_cells.remove(pos);
+	}
+	for(const Chthon::Point & reserved : { start, artifact }) {
+		Chthon::Point pos = reserved - origin;
+		if(pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height) {
+			chunk.set(PLANE_FOREST, cell_index(pos), false);
+			free_cells.remove(pos);
+		}
+	}
+	for(int i = 0; i < area / TREASURE_AREA && !free_cells.empty(); ++i) {
+		chunk.set(PLANE_TREASURE, cell_index(free_cells.take(random)), true);
+	}
+	for(int i = 0; i < area / EVIL_AREA && !free_cells.empty(); ++i) {
+		int count = 1 + random.range(max_enemy_count);
+		int offset = cell_index(free_cells.take(random));
+		chunk.set(PLANE_EVIL_LOW, offset, count & 1);
+		chunk.set(PLANE_EVIL_HIGH, offset, count & 2);
+	}
+
+	apply_changes(index, chunk);
+}
+
+void World::apply_changes(int index, Chunk & chunk) const
+{
+	const Changes * found = find_changes(index);
+	if(!found) {
+		return;
+	}
+	const Changes & chunk_changes = *found;
+	for(int i = 0; i < CHUNK_WORDS; ++i) {
+		chunk.words[PLANE_SEEN][i] |= chunk_changes.words[CHANGE_SEEN][i];
+		uint64_t kept = ~chunk_changes.words[CHANGE_CLEARED][i];
+		uint64_t moved = chunk_changes.words[CHANGE_MOVED][i];
+		chunk.words[PLANE_FOREST][i] &= kept;
+		chunk.words[PLANE_TREASURE][i] &= kept;
+		chunk.words[PLANE_EVIL_LOW][i] = (chunk.words[PLANE_EVIL_LOW][i] & kept & ~moved) | (chunk_changes.words[CHANGE_EVIL_LOW][i] & moved);
+		chunk.words[PLANE_EVIL_HIGH][i] = (chunk.words[PLANE_EVIL_HIGH][i] & kept & ~moved) | (chunk_changes.words[CHANGE_EVIL_HIGH][i] & moved);
+	}
+}
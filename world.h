@@ -0,0 +1,223 @@
+#pragma once
+#include "random.h"
+#include <chthon2/point.h>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+enum {
+	CHUNK_BITS = 5,
+	CHUNK_SIZE = 1 << CHUNK_BITS,
+	CHUNK_AREA = CHUNK_SIZE * CHUNK_SIZE,
+	CHUNK_WORDS = CHUNK_AREA / 64,
+	MAX_RESIDENT_CHUNKS = 64,
+	MAX_WORLD_SIZE = 1 << 20,
+	// One treasure and one evil group for so many cells of a chunk.
+	TREASURE_AREA = 25,
+	EVIL_AREA = 25,
+	// Group sizes are saved in two bitplanes.
+	MAX_EVIL_GROUP = 3,
+	// Changes are split by chunk index, so the first write after a copy
+	// copies only one part of them.
+	CHANGE_SHARDS = 64
+};
+
+// Copy on write: returns the object for writing, copied first if another
+// owner shares it.
+template<class T>
+T & unshare(std::shared_ptr<T> & shared)
+{
+	if(!shared.unique()) {
+		shared = std::make_shared<T>(*shared);
+	}
+	return *shared;
+}
+
+Chthon::Point random_pos(Random & random, int width, int height);
+
+// Set of cells that are still free, with O(1) removal and exact uniform
+// sampling: cells are kept densely packed, removal moves the last one
+// into the freed slot.
+// Copies share the cells until one of them removes some.
+class FreeCells {
+public:
+	FreeCells(int width, int height);
+	int size() const { return set->cells.size(); }
+	bool empty() const { return set->cells.empty(); }
+	bool contains(const Chthon::Point & pos) const { return set->slots[index(pos)] >= 0; }
+	void remove(const Chthon::Point & pos);
+	Chthon::Point sample(Random & random) const;
+	// Samples a free cell and removes it from the set.
+	Chthon::Point take(Random & random);
+	// Cell indices in the order that decides what take() picks next.
+	const std::vector<int> & order() const { return set->cells; }
+	void restore(const std::vector<int> & free_cells);
+private:
+	struct Set {
+		std::vector<int> cells;
+		// Slot of every cell in cells, -1 once it is removed.
+		std::vector<int> slots;
+	};
+	int width;
+	std::shared_ptr<Set> set;
+
+	int index(const Chthon::Point & pos) const { return pos.y * width + pos.x; }
+	Chthon::Point pos(int index) const { return Chthon::Point(index % width, index / width); }
+};
+
+struct Cell {
+	char sprite;
+	bool seen;
+	// Size of the evil group standing here, 0 if there is none.
+	int8_t evil;
+	Cell(char cell_sprite = ' ', bool cell_seen = false, int cell_evil = 0)
+		: sprite(cell_sprite), seen(cell_seen), evil(cell_evil)
+	{}
+};
+
+// Seen cells of an area by what is there.
+struct SeenCells {
+	int forest, grass, treasure;
+	SeenCells() : forest(0), grass(0), treasure(0) {}
+};
+
+// Square world of any size, made of CHUNK_SIZE chunks. A chunk is
+// generated from the world seed and its own index the first time one of
+// its cells is read, so the whole world never has to exist at once, and
+// the order of visits does not change what is found there.
+// Chunks are kept as bitplanes (seen, forest, treasure and two bits of
+// evil), five bits a cell, so queries over a row of cells take a few
+// words rather than a read of every cell.
+// Only MAX_RESIDENT_CHUNKS chunks are kept; the least recently used one
+// is dropped and generated again when needed. What the player changes
+// (seen cells, picked treasure, defeated or moved evil) is kept apart as
+// a few bits per cell of the touched chunks and applied on top of
+// a generated chunk.
+// Copies share their chunks and changes until one of them writes there,
+// so a copy costs a few pointers per resident chunk and no cells, and the
+// first write copies one chunk and one shard of the changes.
+// A World is for one thread only, even for const access: reads update the
+// resident chunks and their last use. Threads should use their own copies.
+class World {
+public:
+	World();
+	// Start and artifact cells are left free of forest, treasure and evil.
+	World(uint64_t world_seed, int world_size, int world_max_enemy_count,
+			const Chthon::Point & world_start, const Chthon::Point & world_artifact);
+	int width() const { return size; }
+	int height() const { return size; }
+	bool valid(const Chthon::Point & pos) const { return pos.x >= 0 && pos.x < size && pos.y >= 0 && pos.y < size; }
+	Cell cell(const Chthon::Point & pos) const
+	{
+		int index = chunk_index(pos);
+		int offset = cell_index(pos);
+		if(last_slot >= 0 && resident_index[last_slot] == index) {
+			return cell_of(*resident[last_slot], offset);
+		}
+		return cell_of(chunk(index), offset);
+	}
+	Cell cell(int x, int y) const { return cell(Chthon::Point(x, y)); }
+	// Cells from row_start to the right, count of them (at most 64), as bits
+	// from the lowest one. Cells outside the world count as forest.
+	uint64_t forest_row(const Chthon::Point & row_start, int count) const { return row(PLANE_FOREST, row_start, count, true); }
+	// Cells with evil in them, the same way.
+	uint64_t evil_row(const Chthon::Point & row_start, int count) const
+	{
+		return row(PLANE_EVIL_LOW, row_start, count, false) | row(PLANE_EVIL_HIGH, row_start, count, false);
+	}
+	// Counts a row of words at a time, only in explored chunks, so the rest
+	// of the world is not generated for it.
+	SeenCells seen_cells(const Chthon::Point & corner, int area_width, int area_height) const;
+	// False if nothing in the chunk of this cell was ever seen.
+	bool explored(const Chthon::Point & pos) const { return find_changes(chunk_index(pos)) || saved(chunk_index(pos)); }
+	// Top left cells of explored chunks, row by row.
+	std::vector<Chthon::Point> explored_chunks() const;
+	void see(const Chthon::Point & pos);
+	// Treasure is picked up or evil is defeated, the cell becomes grass.
+	void clear(const Chthon::Point & pos);
+	// Evil group of that size comes or leaves, 0 for none.
+	void set_evil(const Chthon::Point & pos, int count);
+
+	// Writes the world parameters and every explored chunk as bitplanes.
+	void save(std::ostream & out) const;
+	// Takes the world written by save() from memory, e.g. a mapped file.
+	// Nothing is parsed or copied up front: chunks are copied from there when
+	// they are needed, and storage keeps the memory alive meanwhile.
+	// The data should be 8-byte aligned. Returns false if it is too short or
+	// its chunk indices are not increasing within the world.
+	bool load(const char * data, size_t data_size, const std::shared_ptr<const void> & storage);
+	// Takes the chunks back from a save just written by this very world, so
+	// the next save copies them from there instead of generating them again.
+	// Resident chunks are kept, and the changes are in the save already.
+	bool reload(const char * data, size_t data_size, const std::shared_ptr<const void> & storage);
+private:
+	enum { PLANE_SEEN, PLANE_FOREST, PLANE_TREASURE, PLANE_EVIL_LOW, PLANE_EVIL_HIGH, PLANE_COUNT };
+	// Evil that came or left is marked as moved, the new group size is in two bits.
+	enum { CHANGE_SEEN, CHANGE_CLEARED, CHANGE_MOVED, CHANGE_EVIL_LOW, CHANGE_EVIL_HIGH, CHANGE_COUNT };
+	// Bits of every cell of a chunk, row by row, two rows a word.
+	template<int COUNT>
+	struct Bitplanes {
+		uint64_t words[COUNT][CHUNK_WORDS];
+		bool test(int plane, int offset) const { return words[plane][offset / 64] >> (offset % 64) & 1; }
+		void set(int plane, int offset, bool value)
+		{
+			uint64_t bit = uint64_t(1) << (offset % 64);
+			words[plane][offset / 64] = value ? words[plane][offset / 64] | bit : words[plane][offset / 64] & ~bit;
+		}
+		uint32_t row(int plane, int y) const { return uint32_t(words[plane][y / 2] >> (y % 2 * CHUNK_SIZE)); }
+	};
+	// Saved as they are.
+	typedef Bitplanes<PLANE_COUNT> Chunk;
+	typedef Bitplanes<CHANGE_COUNT> Changes;
+	struct SavedWorld {
+		uint64_t seed;
+		int32_t size, max_enemy_count;
+		int32_t start_x, start_y, artifact_x, artifact_y;
+		int32_t chunk_count;
+	};
+	typedef std::unordered_map<int, std::shared_ptr<Changes>> ChangeMap;
+	// Shards by chunk index, null until something there is changed.
+	typedef std::array<std::shared_ptr<ChangeMap>, CHANGE_SHARDS> ChangeShards;
+
+	uint64_t seed;
+	int size, chunks_per_row;
+	int max_enemy_count;
+	Chthon::Point start, artifact;
+	mutable std::vector<std::shared_ptr<Chunk>> resident;
+	// Chunk index and last use of every resident slot, packed apart for
+	// fast lookup and so that reads never write into shared chunks.
+	mutable std::vector<int> resident_index;
+	mutable std::vector<unsigned long> resident_used;
+	mutable unsigned long clock;
+	mutable int last_slot;
+	std::shared_ptr<ChangeShards> changes;
+	// Chunks of a loaded save, sorted by index.
+	std::shared_ptr<const void> saved_storage;
+	const int32_t * saved_indices;
+	const Chunk * saved_chunks;
+	int saved_count;
+
+	int chunk_index(const Chthon::Point & pos) const { return (pos.y >> CHUNK_BITS) * chunks_per_row + (pos.x >> CHUNK_BITS); }
+	static int cell_index(const Chthon::Point & pos) { return ((pos.y & (CHUNK_SIZE - 1)) << CHUNK_BITS) + (pos.x & (CHUNK_SIZE - 1)); }
+	static Cell cell_of(const Chunk & source, int offset)
+	{
+		char sprite = source.test(PLANE_FOREST, offset) ? '#' : source.test(PLANE_TREASURE, offset) ? '*' : '.';
+		return Cell(sprite, source.test(PLANE_SEEN, offset), source.test(PLANE_EVIL_LOW, offset) + 2 * source.test(PLANE_EVIL_HIGH, offset));
+	}
+	uint64_t row(int plane, const Chthon::Point & row_start, int count, bool outside) const;
+	const Chunk & chunk(int index) const;
+	// Chunk and changes for writing, copied first if they are shared.
+	Chunk & own_chunk(int index);
+	Changes & own_changes(int index);
+	const Changes * find_changes(int index) const;
+	const Chunk * saved(int index) const;
+	// Returns false if the saved world is too short for its header and
+	// chunks, or its chunk indices are not increasing within the world.
+	static bool read_saved(const char * data, size_t data_size, SavedWorld & header);
+	void use_saved(const char * data, const SavedWorld & header, const std::shared_ptr<const void> & storage);
+	void generate(int index, Chunk & chunk) const;
+	void apply_changes(int index, Chunk & chunk) const;
+};